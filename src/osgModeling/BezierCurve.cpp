@@ -22,7 +22,7 @@ using namespace osgModeling;
 
 BezierCurve::BezierCurve():
     osgModeling::Curve(),
-    _method(1), _ctrlPts(0), _cont(0.0f), _degree(3), _numPath(20)
+    _method(2), _ctrlPts(0), _cont(0.0f), _degree(3), _numPath(20)
 {
 }
 
@@ -30,19 +30,19 @@ BezierCurve::BezierCurve( const BezierCurve& copy, const osg::CopyOp& copyop/*=o
     osgModeling::Curve(copy,copyop),
     _method(copy._method), _cont(copy._cont), _degree(copy._degree), _numPath(copy._numPath)
 {
-    _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
+    if ( copy._ctrlPts.valid() ) _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
 }
 
 BezierCurve::BezierCurve( osg::Vec3Array* pts, unsigned int degree, unsigned int numPath ):
     osgModeling::Curve(),
-    _method(1), _ctrlPts(pts), _degree(degree), _numPath(numPath)
+    _method(2), _ctrlPts(pts), _cont(0.0f), _degree(degree), _numPath(numPath)
 {
     update();
 }
 
 BezierCurve::BezierCurve( unsigned int stride, unsigned int order, double* ptr, unsigned int numPath ):
     osgModeling::Curve(),
-    _method(1), _degree(order-1), _numPath(numPath)
+    _method(2), _cont(0.0f), _degree(order-1), _numPath(numPath)
 {
     if ( stride<2 || !ptr ) return;
     if ( !_ctrlPts ) _ctrlPts = new osg::Vec3Array;
@@ -76,14 +76,67 @@ osg::Vec3 BezierCurve::lerpRecursion( osg::Vec3Array* pts, unsigned int r, unsig
         u );
 }
 
+#define BINOMIAL_TABLE_SIZE 32
+
+struct BinomialTable
+{
+    double _values[BINOMIAL_TABLE_SIZE][BINOMIAL_TABLE_SIZE];
+
+    // Build the Pascal's triangle.
+    BinomialTable()
+    {
+        for ( unsigned int n=0; n<BINOMIAL_TABLE_SIZE; ++n )
+        {
+            _values[n][0] = 1.0;
+            for ( unsigned int i=1; i<BINOMIAL_TABLE_SIZE; ++i )
+                _values[n][i] = (i>n) ? 0.0 : _values[n-1][i-1] + (i<n ? _values[n-1][i] : 0.0);
+        }
+    }
+};
+
+static const BinomialTable binomialTable;
+
+double BezierCurve::binomial( unsigned int n, unsigned int i )
+{
+    if ( i>n ) return 0.0;
+    if ( n<BINOMIAL_TABLE_SIZE ) return binomialTable._values[n][i];
+    return factorial(n, false) / (factorial(i, false) * factorial(n-i, false));
+}
+
 double BezierCurve::bernstein( int k, int i, double u )
 {
-    double basis = factorial(k) / (factorial(i) * factorial(k-i));
+    double basis = binomial( k, i );
     basis *= (u==0.0f && i==0) ? 1.0f : pow(u, i);
     basis *= (u==1.0f && i==k) ? 1.0f : pow(1-u, k-i);
     return basis;
 }
 
+void BezierCurve::bernsteinBasis( unsigned int k, double u, double* basis )
+{
+    // B(i,k) = C(k,i) * u^i * (1-u)^(k-i): raise u upwards first and then (1-u) downwards.
+    unsigned int i;
+    double s=1.0-u, power=1.0;
+    basis[0] = 1.0;
+    for ( i=1; i<=k; ++i )
+        basis[i] = basis[i-1] * u;
+    for ( i=k+1; i>0; --i )
+    {
+        basis[i-1] *= binomial(k, i-1) * power;
+        power *= s;
+    }
+}
+
+void BezierCurve::BasisCache::build( unsigned int k, unsigned int numPath )
+{
+    _degree = k;
+    _numPath = numPath;
+    _basis.resize( numPath*(k+1) );
+
+    double interval = numPath>1 ? 1.0/(numPath-1) : 0.0;
+    for ( unsigned int i=0; i<numPath; ++i )
+        bernsteinBasis( k, i*interval, &(_basis[i*(k+1)]) );
+}
+
 void BezierCurve::updateImplementation()
 {
     if ( !_ctrlPts ) return;
@@ -106,33 +159,55 @@ void BezierCurve::updateImplementation()
             "there should be " << _degree << "N+1 control points and overflows are ignored." << std::endl;
     }
 
+    applyContinuity();
+
     osg::ref_ptr<osg::Vec3Array> pathArray = new osg::Vec3Array;
-    if ( _method==0 ) useBernstein( pathArray.get() );
+    if ( isAdaptive() )
+    {
+        unsigned int segments = (_ctrlPts->size()-1)/_degree;
+        VECTOR<double> breaks( segments+1 );
+        for ( unsigned int j=0; j<=segments; ++j )
+            breaks[j] = (double)j / segments;
+        adaptiveSample( breaks, pathArray.get() );
+    }
+    else if ( _method==0 ) useBernstein( pathArray.get() );
     else if ( _method==1 ) useDeCasteljau( pathArray.get() );
+    else if ( _method==2 ) useForwardDifference( pathArray.get() );
     setPath( pathArray.get() );
 }
 
+void BezierCurve::applyContinuity()
+{
+    if ( !_cont ) return;
+
+    unsigned int k=_degree;
+    unsigned int segments = ( _ctrlPts->size()-1)/k;
+    for ( unsigned int j=1; j<segments; ++j )
+    {
+        // Adjust relative control points.
+        (*_ctrlPts)[j*k+1] = (*_ctrlPts)[j*k] + ((*_ctrlPts)[j*k]-(*_ctrlPts)[j*k-1])/_cont;
+    }
+}
+
 void BezierCurve::useBernstein( osg::Vec3Array* result )
 {
     unsigned int i, j, n, k=_degree;
     unsigned int segments = ( _ctrlPts->size()-1)/k;
     unsigned int numEachPath = _numPath/segments;
     double interval = 1.0f / (numEachPath-1);
+
+    // All segments share the same parameters, so calculate basis functions once.
+    VECTOR<double> basis( numEachPath*(k+1) );
+    for ( n=0; n<numEachPath; ++n )
+        bernsteinBasis( k, n*interval, &(basis[n*(k+1)]) );
+
     for ( j=0; j<segments; ++j )
     {
-        if ( _cont && j>0 )
-        {
-            // Adjust relative control points.
-            (*_ctrlPts)[j*k+1] = (*_ctrlPts)[j*k] + ((*_ctrlPts)[j*k]-(*_ctrlPts)[j*k-1])/_cont;
-        }
-
         for ( n=0; n<numEachPath; ++n )
         {
-            double u = n*interval;
-
             osg::Vec3 pathPoint;
             for ( i=0; i<=k; ++i )
-                pathPoint += (*_ctrlPts)[j*k+i] * bernstein( k, i, u );
+                pathPoint += (*_ctrlPts)[j*k+i] * basis[n*(k+1)+i];
             result->push_back( pathPoint );
         }
     }
@@ -146,18 +221,148 @@ void BezierCurve::useDeCasteljau( osg::Vec3Array* result )
     double interval = 1.0f / (numEachPath-1);
     for ( j=0; j<segments; ++j )
     {
-        if ( _cont && j>0 )
+        for ( n=0; n<numEachPath; ++n )
         {
-            // Adjust relative control points.
-            (*_ctrlPts)[j*k+1] = (*_ctrlPts)[j*k] + ((*_ctrlPts)[j*k]-(*_ctrlPts)[j*k-1])/_cont;
+            double u = n*interval;
+
+            osg::Vec3 pathPoint = lerpRecursion( _ctrlPts.get(), k, j*k, u );
+            result->push_back( pathPoint );
+        }
+    }
+}
+
+void BezierCurve::useForwardDifference( osg::Vec3Array* result )
+{
+    unsigned int i, j, m, n, r, k=_degree;
+    unsigned int segments = ( _ctrlPts->size()-1)/k;
+    unsigned int numEachPath = _numPath/segments;
+    double interval = numEachPath>1 ? 1.0 / (numEachPath-1) : 0.0;
+
+    // Differences are re-calculated from the polynomial after this number of samples.
+    const unsigned int anchorInterval = 32;
+
+    VECTOR<osg::Vec3d> coeffs( k+1 ), diffs( k+1 );
+    result->reserve( result->size()+segments*numEachPath );
+    for ( j=0; j<segments; ++j )
+    {
+        // Power basis coefficients: a(i) = C(k,i) * sum( (-1)^(i-m) * C(i,m) * P(m) ).
+        for ( i=0; i<=k; ++i )
+        {
+            osg::Vec3d sum;
+            for ( m=0; m<=i; ++m )
+            {
+                double c = binomial(i, m) * ((i-m)%2 ? -1.0 : 1.0);
+                sum += osg::Vec3d( (*_ctrlPts)[j*k+m] ) * c;
+            }
+            coeffs[i] = sum * binomial(k, i);
         }
 
         for ( n=0; n<numEachPath; ++n )
         {
-            double u = n*interval;
+            if ( n%anchorInterval==0 )
+            {
+                // Evaluate k+1 samples from n with Horner's rule, and build the difference table in place.
+                for ( r=0; r<=k; ++r )
+                {
+                    double u = (n+r)*interval;
+                    osg::Vec3d value = coeffs[k];
+                    for ( i=k; i>0; --i )
+                        value = value*u + coeffs[i-1];
+                    diffs[r] = value;
+                }
+                for ( i=1; i<=k; ++i )
+                {
+                    for ( r=k; r>=i; --r )
+                        diffs[r] -= diffs[r-1];
+                }
+            }
 
-            osg::Vec3 pathPoint = lerpRecursion( _ctrlPts.get(), k, 0, u );
-            result->push_back( pathPoint );
+            result->push_back( diffs[0] );
+            for ( i=0; i<k; ++i )
+                diffs[i] += diffs[i+1];
         }
     }
 }
+
+bool BezierCurve::evaluate( const double* params, unsigned int n, osg::Vec3* out ) const
+{
+    if ( !_ctrlPts || !params || !out || !_degree || _ctrlPts->size()<_degree+1 )
+        return false;
+
+    unsigned int i, lane, start, k=_degree, order=_degree+1;
+    unsigned int segments = (_ctrlPts->size()-1)/k;
+    unsigned int numCtrl = segments*k+1;
+
+    // Store control points as separated coordinate arrays.
+    VECTOR<double> px(numCtrl), py(numCtrl), pz(numCtrl);
+    for ( i=0; i<numCtrl; ++i )
+    {
+        px[i] = (*_ctrlPts)[i].x();
+        py[i] = (*_ctrlPts)[i].y();
+        pz[i] = (*_ctrlPts)[i].z();
+    }
+
+    // Binomial coefficients of the Bernstein polynomials.
+    VECTOR<double> binomial(order);
+    binomial[0] = 1.0;
+    for ( i=1; i<order; ++i )
+        binomial[i] = binomial[i-1] * (k-i+1) / i;
+
+    const unsigned int block = EVALUATE_BLOCK_SIZE;
+    VECTOR<double> basis(order*block);
+    unsigned int first[EVALUATE_BLOCK_SIZE];
+    double t[EVALUATE_BLOCK_SIZE], s[EVALUATE_BLOCK_SIZE], power[EVALUATE_BLOCK_SIZE];
+    double x[EVALUATE_BLOCK_SIZE], y[EVALUATE_BLOCK_SIZE], z[EVALUATE_BLOCK_SIZE];
+    for ( start=0; start<n; start+=block )
+    {
+        unsigned int num = osg::minimum( block, n-start );
+        for ( lane=0; lane<block; ++lane )
+        {
+            double u = lane<num ? params[start+lane]*segments : 0.0;
+            if ( u<0.0 ) u = 0.0;
+            else if ( u>segments ) u = segments;
+
+            unsigned int seg = (unsigned int)u;
+            if ( seg>=segments ) seg = segments-1;
+            first[lane] = seg*k;
+            t[lane] = u - seg;
+            s[lane] = 1.0 - t[lane];
+        }
+
+        // B(i,k) = C(k,i) * t^i * (1-t)^(k-i): raise t upwards first and then (1-t) downwards.
+        for ( lane=0; lane<block; ++lane )
+            basis[lane] = 1.0;
+        for ( i=1; i<order; ++i )
+        {
+            for ( lane=0; lane<block; ++lane )
+                basis[i*block+lane] = basis[(i-1)*block+lane] * t[lane];
+        }
+        for ( lane=0; lane<block; ++lane )
+            power[lane] = 1.0;
+        for ( i=order; i>0; --i )
+        {
+            for ( lane=0; lane<block; ++lane )
+            {
+                basis[(i-1)*block+lane] *= binomial[i-1] * power[lane];
+                power[lane] *= s[lane];
+            }
+        }
+
+        for ( lane=0; lane<block; ++lane )
+            x[lane] = y[lane] = z[lane] = 0.0;
+        for ( i=0; i<order; ++i )
+        {
+            for ( lane=0; lane<block; ++lane )
+            {
+                double b = basis[i*block+lane];
+                x[lane] += px[first[lane]+i] * b;
+                y[lane] += py[first[lane]+i] * b;
+                z[lane] += pz[first[lane]+i] * b;
+            }
+        }
+
+        for ( lane=0; lane<num; ++lane )
+            out[start+lane].set( x[lane], y[lane], z[lane] );
+    }
+    return true;
+}
@@ -15,6 +15,7 @@
 * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <osgModeling/Utilities>
 #include <osgModeling/Bezier>
 #include <osgModeling/NormalVisitor>
 #include <osgModeling/TexCoordVisitor>
@@ -23,21 +24,24 @@ using namespace osgModeling;
 
 BezierSurface::BezierSurface():
     osgModeling::Model(),
-    _ctrlPts(0), _degreeU(3), _degreeV(3), _numPathU(10), _numPathV(10)
+    _method(0), _ctrlPts(0), _degreeU(3), _degreeV(3), _numPathU(10), _numPathV(10)
 {
 }
 
 BezierSurface::BezierSurface( const BezierSurface& copy, const osg::CopyOp& copyop/*=osg::CopyOp::SHALLOW_COPY*/ ):
     osgModeling::Model(copy,copyop),
-    _degreeU(copy._degreeU), _degreeV(copy._degreeV), _numPathU(copy._numPathU), _numPathV(copy._numPathV)
+    _method(copy._method), _degreeU(copy._degreeU), _degreeV(copy._degreeV),
+    _numPathU(copy._numPathU), _numPathV(copy._numPathV),
+    _sampledVertices(copy._sampledVertices), _sampledNormals(copy._sampledNormals),
+    _basisCacheU(copy._basisCacheU), _basisCacheV(copy._basisCacheV)
 {
-    _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
+    if ( copy._ctrlPts.valid() ) _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
 }
 
 BezierSurface::BezierSurface( osg::Vec3Array* pts, unsigned int degreeU, unsigned int degreeV,
                              unsigned int numPathU, unsigned int numPathV ):
     osgModeling::Model(),
-    _ctrlPts(pts), _degreeU(degreeU), _degreeV(degreeV),
+    _method(0), _ctrlPts(pts), _degreeU(degreeU), _degreeV(degreeV),
     _numPathU(numPathU), _numPathV(numPathV)
 {
     update();
@@ -46,7 +50,7 @@ BezierSurface::BezierSurface( osg::Vec3Array* pts, unsigned int degreeU, unsigne
 BezierSurface::BezierSurface( unsigned int ustride, unsigned int uorder, unsigned int vstride, unsigned int vorder,
                              double* ptr, unsigned int numPathU, unsigned int numPathV ):
     osgModeling::Model(),
-    _degreeU(uorder-1), _degreeV(vorder-1), _numPathU(numPathU), _numPathV(numPathV)
+    _method(0), _degreeU(uorder-1), _degreeV(vorder-1), _numPathU(numPathU), _numPathV(numPathV)
 {
     if ( ustride<2 || vstride<2 || !ptr ) return;
     if ( !_ctrlPts ) _ctrlPts = new osg::Vec3Array;
@@ -86,12 +90,32 @@ void BezierSurface::updateImplementation()
         return;
     }
 
-    // Initiate vertics & texture coordinates.
-    osg::ref_ptr<osg::Vec3Array> vertics = new osg::Vec3Array;
-    osg::ref_ptr<osg::Vec2Array> texCoords = new osg::Vec2Array;
+    if ( isAdaptive() )
+    {
+        VECTOR<double> breaks( 2 );
+        breaks[0] = 0.0;
+        breaks[1] = 1.0;
+        buildAdaptiveGeometry( breaks, breaks );
+        return;
+    }
 
-    // Generate vertics.
-    useDeCasteljau( vertics.get() );
+    // Initiate vertics, refilling the existing array unless they are picked from a finer grid.
+    osg::ref_ptr<osg::Vec3Array> vertics, normals;
+    if ( _sampledVertices.valid() && _sampledVertices->size()==_numPathU*_numPathV )
+    {
+        vertics = _sampledVertices;
+        normals = _sampledNormals;
+    }
+    else
+    {
+        vertics = reuseArray<osg::Vec3Array>( getVertexArray() );
+
+        // Generate vertics.
+        if ( _method==0 ) useBernsteinMatrices( vertics.get() );
+        else if ( _method==1 ) useDeCasteljau( vertics.get() );
+    }
+    _sampledVertices = NULL;
+    _sampledNormals = NULL;
 
     // Create new primitives for surface.
     unsigned int bodySize = vertics->size();
@@ -104,66 +128,216 @@ void BezierSurface::updateImplementation()
         capType = osg::PrimitiveSet::LINE_STRIP;
     }
 
-    if ( getGenerateParts()&Model::BODY_PART )
+    // Primitives are kept if only positions changed.
+    if ( !canReusePrimitives(bodySize) )
     {
-        for ( i=0; i<_numPathU-1; ++i )
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
+        if ( getGenerateParts()&Model::BODY_PART )
         {
-            osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
-            for ( j=0; j<_numPathV; ++j )
+            for ( i=0; i<_numPathU-1; ++i )
             {
-                bodySeg->push_back( j+i*_numPathV );
-                bodySeg->push_back( j+(i+1)*_numPathV );
+                osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
+                for ( j=0; j<_numPathV; ++j )
+                {
+                    bodySeg->push_back( j+i*_numPathV );
+                    bodySeg->push_back( j+(i+1)*_numPathV );
+                }
+                addPrimitiveSet( bodySeg.get() );
             }
-            addPrimitiveSet( bodySeg.get() );
         }
     }
 
     // Attach vertics to the geometry.
     setVertexArray( vertics.get() );
 
-    // Calculate normals using smoothing visitor.
-    if ( getGenerateCoords()&Model::NORMAL_COORDS )
+    // Calculate normals using smoothing visitor, or take those picked from a finer grid, which are already flipped.
+    if ( normals.valid() )
     {
-        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL );
+        setNormalArray( normals.get() );
+        setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    }
+    else if ( getGenerateCoords()&Model::NORMAL_COORDS )
+    {
+        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL,
+            NormalVisitor::MWE, 1e-6, true, getNumThreads() );
     }
 
     // Calculate texture coordinates.
-    osg::Vec3Array::iterator itr;
     if ( getGenerateCoords()&Model::TEX_COORDS )
+        setGridTexCoords( _numPathU, _numPathV );
+
+    dirtyDisplayList();
+}
+
+Model* BezierSurface::createCoarseModel( double ratio )
+{
+    unsigned int numU = _numPathU>1 ? reduceIntervals( _numPathU-1, ratio, 1 )+1 : _numPathU;
+    unsigned int numV = _numPathV>1 ? reduceIntervals( _numPathV-1, ratio, 1 )+1 : _numPathV;
+    if ( !isAdaptive() && numU==_numPathU && numV==_numPathV )
+        return NULL;
+
+    BezierSurface* surface = dynamic_cast<BezierSurface*>( clone(osg::CopyOp::SHALLOW_COPY) );
+    if ( !surface ) return NULL;
+
+    if ( isAdaptive() )
     {
-        double maxTexCoordOfBody = 1.0;
-        double uInterval=maxTexCoordOfBody/(_numPathU-1), vInterval=1.0f/(_numPathV-1);
+        surface->setTolerance( _tolerance/ratio );
+        return surface;
+    }
+    surface->setNumPath( numU, numV );
+
+    // Vertices of the coarse grid are also vertices of this one if intervals are reduced by a whole factor.
+    bool needNormals = (getGenerateCoords()&Model::NORMAL_COORDS)!=0;
+    if ( _updated && !_dirty && !isUpdating() && !(getAuxFunctions()&Model::OPTIMIZE_VERTEX_CACHE) )
+    {
+        surface->_sampledVertices = sampleGrid( getVertexArray(), _numPathU, _numPathV, numU, numV );
+        if ( needNormals ) surface->_sampledNormals = sampleGrid( getNormalArray(), _numPathU, _numPathV, numU, numV );
+        if ( surface->_sampledVertices.valid() && (!needNormals || surface->_sampledNormals.valid()) )
+            surface->update();
+        surface->_sampledVertices = NULL;
+        surface->_sampledNormals = NULL;
+    }
+    return surface;
+}
+
+bool BezierSurface::updateTexCoords()
+{
+    const osg::Array* vertices = getVertexArray();
+    if ( !(getGenerateCoords()&Model::TEX_COORDS) || isAdaptive() || (getAuxFunctions()&Model::OPTIMIZE_VERTEX_CACHE)
+        || !vertices || vertices->getNumElements()!=_numPathU*_numPathV )
+        return Model::updateTexCoords();
+
+    setGridTexCoords( _numPathU, _numPathV );
+    dirtyDisplayList();
+    return true;
+}
+
+void BezierSurface::copyGeneratedData( Model& source )
+{
+    Model::copyGeneratedData( source );
+
+    BezierSurface* surface = dynamic_cast<BezierSurface*>( &source );
+    if ( !surface ) return;
+    _basisCacheU = surface->_basisCacheU;
+    _basisCacheV = surface->_basisCacheV;
+}
+
+namespace osgModeling {
+
+class BezierSurfaceRowTask : public ParallelTask
+{
+public:
+    BezierSurfaceRowTask( BezierSurface* surface, int method, osg::Vec3* result ):
+        _surface(surface), _method(method), _result(result)
+    {}
 
-        for ( i=0; i<_numPathU; ++i )
+    virtual void run( unsigned int begin, unsigned int end )
+    {
+        if ( _method==0 ) _surface->bernsteinRows( begin, end, _result );
+        else _surface->deCasteljauRows( begin, end, _result );
+    }
+
+protected:
+    BezierSurface* _surface;
+    int _method;
+    osg::Vec3* _result;
+};
+
+}
+
+void BezierSurface::useBernsteinMatrices( osg::Vec3Array* result )
+{
+    if ( !_basisCacheU.valid(_degreeU, _numPathU) ) _basisCacheU.build( _degreeU, _numPathU );
+    if ( !_basisCacheV.valid(_degreeV, _numPathV) ) _basisCacheV.build( _degreeV, _numPathV );
+
+    // Pre-size the result so that rows can be written by different threads.
+    unsigned int numVertices = _numPathU*_numPathV;
+    result->resize( result->size()+numVertices );
+
+    BezierSurfaceRowTask task( this, 0, &((*result)[result->size()-numVertices]) );
+    parallelRun( task, _numPathU, getNumThreads(), PARALLEL_GRAIN_SIZE/_numPathV+1 );
+}
+
+void BezierSurface::bernsteinRows( unsigned int begin, unsigned int end, osg::Vec3* result ) const
+{
+    unsigned int m, n, a, b, orderU=_degreeU+1, orderV=_degreeV+1;
+    VECTOR<osg::Vec3d> row( orderV );
+    for ( m=begin; m<end; ++m )
+    {
+        // Row m of T = Bu * P, with a column for each V control point.
+        const double* basisU = _basisCacheU.getBasis( m );
+        for ( b=0; b<orderV; ++b )
         {
-            for ( j=0; j<_numPathV; ++j )
-            {
-                texCoords->push_back(
-                    osg::Vec2(uInterval*i, vInterval*j) );
-            }
+            osg::Vec3d pt;
+            for ( a=0; a<orderU; ++a )
+                pt += osg::Vec3d( (*_ctrlPts)[a*orderV+b] ) * basisU[a];
+            row[b] = pt;
         }
 
-        setTexCoordArray( 0, texCoords.get() );
+        // Row m of result = T * Bv'.
+        for ( n=0; n<_numPathV; ++n )
+        {
+            const double* basisV = _basisCacheV.getBasis( n );
+            osg::Vec3d pt;
+            for ( b=0; b<orderV; ++b )
+                pt += row[b] * basisV[b];
+            result[m*_numPathV+n] = pt;
+        }
     }
-
-    dirtyDisplayList();
 }
 
 void BezierSurface::useDeCasteljau( osg::Vec3Array* result )
+{
+    unsigned int numVertices = _numPathU*_numPathV;
+    result->resize( result->size()+numVertices );
+
+    BezierSurfaceRowTask task( this, 1, &((*result)[result->size()-numVertices]) );
+    parallelRun( task, _numPathU, getNumThreads(), PARALLEL_GRAIN_SIZE/_numPathV+1 );
+}
+
+void BezierSurface::deCasteljauRows( unsigned int begin, unsigned int end, osg::Vec3* result )
 {
     unsigned int m, n;
     double intervalU = 1.0f / (_numPathU-1);
     double intervalV = 1.0f / (_numPathV-1);
 
-    for ( m=0; m<_numPathU; ++m )
+    for ( m=begin; m<end; ++m )
     {
         double u = m*intervalU;
         for ( n=0; n<_numPathV; ++n )
         {
             double v = n*intervalV;
-            result->push_back( lerpRecursion(_degreeU, _degreeV, 0, 0, u, v) );
+            result[m*_numPathV+n] = lerpRecursion( _degreeU, _degreeV, 0, 0, u, v );
+        }
+    }
+}
+
+bool BezierSurface::evaluate( const double* params, unsigned int n, osg::Vec3* out ) const
+{
+    unsigned int orderU=_degreeU+1, orderV=_degreeV+1;
+    if ( !_ctrlPts || !params || !out || _ctrlPts->size()<orderU*orderV )
+        return false;
+
+    unsigned int i, a, b;
+    VECTOR<double> basisU(orderU), basisV(orderV);
+    for ( i=0; i<n; ++i )
+    {
+        double u = osg::clampBetween( params[2*i], 0.0, 1.0 );
+        double v = osg::clampBetween( params[2*i+1], 0.0, 1.0 );
+        BezierCurve::bernsteinBasis( _degreeU, u, &(basisU.front()) );
+        BezierCurve::bernsteinBasis( _degreeV, v, &(basisV.front()) );
+
+        osg::Vec3d pt;
+        for ( a=0; a<orderU; ++a )
+        {
+            osg::Vec3d row;
+            for ( b=0; b<orderV; ++b )
+                row += osg::Vec3d( (*_ctrlPts)[a*orderV+b] ) * basisV[b];
+            pt += row * basisU[a];
         }
+        out[i] = pt;
     }
+    return true;
 }
 
 osg::Vec3 BezierSurface::lerpRecursion( unsigned int r, unsigned int s,
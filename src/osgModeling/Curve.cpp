@@ -15,21 +15,25 @@
 * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <osg/Math>
 #include <osgModeling/Curve>
 
 using namespace osgModeling;
 
 Curve::Curve():
     osg::Object(),
-    _pathPts(0), _algorithmCallback(0), _updated(false)
+    _pathPts(0), _algorithmCallback(0),
+    _chordHeight(0.0), _angle(0.0), _maxSubdivision(10), _updated(false)
 {
 }
 
 Curve::Curve( const Curve& copy, const osg::CopyOp& copyop/*=osg::CopyOp::SHALLOW_COPY*/ ):
     osg::Object(copy,copyop),
-    _algorithmCallback(copy._algorithmCallback), _updated(copy._updated)
+    _algorithmCallback(copy._algorithmCallback),
+    _chordHeight(copy._chordHeight), _angle(copy._angle), _maxSubdivision(copy._maxSubdivision),
+    _updated(copy._updated)
 {
-    _pathPts = dynamic_cast<osg::Vec3Array*>( copy._pathPts->clone(copyop) );
+    if ( copy._pathPts.valid() ) _pathPts = dynamic_cast<osg::Vec3Array*>( copy._pathPts->clone(copyop) );
 }
 
 Curve::~Curve()
@@ -74,3 +78,68 @@ osg::Vec2 Curve::mapTo2D( const osg::Vec3 p, osg::BoundingBox originRect, osg::B
 
     return point2D;
 }
+
+void Curve::adaptiveSample( const VECTOR<double>& breaks, osg::Vec3Array* result ) const
+{
+    if ( breaks.size()<2 ) return;
+
+    unsigned int numBreaks = breaks.size();
+    VECTOR<osg::Vec3> breakPts( numBreaks );
+    if ( !evaluate(&(breaks.front()), numBreaks, &(breakPts.front())) )
+        return;
+
+    result->push_back( breakPts[0] );
+    for ( unsigned int i=1; i<numBreaks; ++i )
+    {
+        if ( breaks[i]<=breaks[i-1] ) continue;
+        subdivide( breaks[i-1], breakPts[i-1], breaks[i], breakPts[i], 0, result );
+    }
+}
+
+void Curve::subdivide( double u0, const osg::Vec3& p0, double u1, const osg::Vec3& p1,
+                      unsigned int depth, osg::Vec3Array* result ) const
+{
+    // Quarter points are also tested, so S-shaped intervals with a straight middle won't be taken as flat.
+    double delta = (u1-u0) * 0.25;
+    double params[3] = { u0+delta, u0+2.0*delta, u0+3.0*delta };
+    osg::Vec3 mid[3];
+    evaluate( params, 3, mid );
+
+    if ( depth<_maxSubdivision && !isFlat(p0, mid, 3, p1) )
+    {
+        subdivide( u0, p0, params[1], mid[1], depth+1, result );
+        subdivide( params[1], mid[1], u1, p1, depth+1, result );
+    }
+    else
+        result->push_back( p1 );
+}
+
+bool Curve::isFlat( const osg::Vec3& p0, const osg::Vec3* mid, unsigned int numMid, const osg::Vec3& p1 ) const
+{
+    unsigned int i;
+    if ( _chordHeight>0.0 )
+    {
+        osg::Vec3 chord = p1 - p0;
+        double length2 = chord.length2();
+        for ( i=0; i<numMid; ++i )
+        {
+            osg::Vec3 v = mid[i] - p0;
+            double height2 = length2>0.0 ? (v^chord).length2()/length2 : v.length2();
+            if ( height2>_chordHeight*_chordHeight ) return false;
+        }
+    }
+
+    if ( _angle>0.0 )
+    {
+        double minCos = cos( _angle );
+        osg::Vec3 lastDir = mid[0] - p0;
+        for ( i=1; i<=numMid; ++i )
+        {
+            osg::Vec3 dir = (i<numMid ? mid[i] : p1) - mid[i-1];
+            double length = lastDir.length() * dir.length();
+            if ( length>0.0 && (lastDir*dir)/length<minCos ) return false;
+            lastDir = dir;
+        }
+    }
+    return true;
+}
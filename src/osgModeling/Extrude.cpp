@@ -41,7 +41,7 @@ Extrude::Extrude( const Extrude& copy, const osg::CopyOp& copyop/*=osg::CopyOp::
     Model(copy, copyop),
     _length(copy._length), _scale(copy._scale), _dir(copy._dir)
 {
-    _profile = dynamic_cast<Curve*>( copy._profile->clone(copyop) );
+    if ( copy._profile.valid() ) _profile = dynamic_cast<Curve*>( copy._profile->clone(copyop) );
 }
 
 Extrude::~Extrude()
@@ -50,18 +50,15 @@ Extrude::~Extrude()
 
 void Extrude::updateImplementation()
 {
-    // First delete previous primitives.
-    removePrimitiveSet( 0, getPrimitiveSetList().size() );
-
     if ( !_profile|| !_profile->getPath() || _profile->getPath()->size()<2 )
     {
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
         osg::notify(osg::WARN) << "osgModeling: Extrude object should have a profile with at least 2 points." <<std::endl;
         return;
     }
 
-    // Initiate vertics & texture coordinates.
-    osg::ref_ptr<osg::Vec3Array> vertics = new osg::Vec3Array;
-    osg::ref_ptr<osg::Vec2Array> texCoords = new osg::Vec2Array;
+    // Initiate vertics, refilling the existing array.
+    osg::ref_ptr<osg::Vec3Array> vertics = reuseArray<osg::Vec3Array>( getVertexArray() );
 
     osg::Vec3 offset = getExtrudeDirection() * getExtrudeLength();
     osg::Vec3 center, offsetCenter;
@@ -81,52 +78,63 @@ void Extrude::updateImplementation()
         vertics->push_back( offsetVec );
     }
 
-    // Create new primitives for body and 2 caps.
+    // Vertices of caps.
     unsigned int bodySize = vertics->size();
     unsigned int i, j;
-    GLenum bodyType = osg::PrimitiveSet::QUAD_STRIP;
-    GLenum capType = osg::PrimitiveSet::TRIANGLE_FAN;
-    if ( getAuxFunctions()&Model::USE_WIREFRAME )
+    bool hasCap1 = (getGenerateParts()&Model::CAP1_PART) && bodySize>4;
+    bool hasCap2 = (getGenerateParts()&Model::CAP2_PART) && bodySize>4;
+    if ( hasCap1 )
     {
-        bodyType = osg::PrimitiveSet::LINES;
-        capType = osg::PrimitiveSet::LINE_STRIP;
+        vertics->push_back( center );
+        for ( i=0; i<bodySize; i+=2 )
+            vertics->push_back( (*vertics)[i] );
     }
-
-    if ( getGenerateParts()&Model::BODY_PART )
+    unsigned int bodyAndCapSize = vertics->size();
+    if ( hasCap2 )
     {
-        osg::ref_ptr<osg::DrawElementsUInt> body = new osg::DrawElementsUInt( bodyType, 0 );
-        for ( i=0; i<bodySize; ++i )
-        {
-            body->push_back( i );
-        }
-        addPrimitiveSet( body.get() );
+        vertics->push_back( offsetCenter );
+        for ( i=1; i<bodySize; i+=2 )
+            vertics->push_back( (*vertics)[i] );
     }
-    if ( getGenerateParts()&Model::CAP1_PART && bodySize>4 )
+    unsigned int capSize = bodySize/2;
+
+    // Primitives are kept if only positions changed, or shared with other models of the same topology.
+    if ( !canReusePrimitives(vertics->size()) && !useSharedTopology(pts->size()) )
     {
-        osg::ref_ptr<osg::DrawElementsUInt> cap1 = new osg::DrawElementsUInt( capType, 0 );
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
 
-        vertics->push_back( center );
-        cap1->push_back( bodySize );
-        for ( i=0, j=1; i<bodySize; i+=2, ++j )
+        GLenum bodyType = osg::PrimitiveSet::QUAD_STRIP;
+        GLenum capType = osg::PrimitiveSet::TRIANGLE_FAN;
+        if ( getAuxFunctions()&Model::USE_WIREFRAME )
         {
-            vertics->push_back( (*vertics)[i] );
-            cap1->push_back( bodySize+j );
+            bodyType = osg::PrimitiveSet::LINES;
+            capType = osg::PrimitiveSet::LINE_STRIP;
         }
-        addPrimitiveSet( cap1.get() );
-    }
-    if ( getGenerateParts()&Model::CAP2_PART && bodySize>4 )
-    {
-        unsigned int bodyAndCapSize = vertics->size();
-        osg::ref_ptr<osg::DrawElementsUInt> cap2 = new osg::DrawElementsUInt( capType, 0 );
 
-        vertics->push_back( offsetCenter );
-        for ( i=1, j=1; i<bodySize; i+=2, ++j )
+        if ( getGenerateParts()&Model::BODY_PART )
         {
-            vertics->push_back( (*vertics)[i] );
-            cap2->insert( cap2->begin(), bodyAndCapSize+j );
+            osg::ref_ptr<osg::DrawElementsUInt> body = new osg::DrawElementsUInt( bodyType, 0 );
+            for ( i=0; i<bodySize; ++i )
+            {
+                body->push_back( i );
+            }
+            addPrimitiveSet( body.get() );
+        }
+        if ( hasCap1 )
+        {
+            osg::ref_ptr<osg::DrawElementsUInt> cap1 = new osg::DrawElementsUInt( capType, 0 );
+            for ( j=0; j<=capSize; ++j )
+                cap1->push_back( bodySize+j );
+            addPrimitiveSet( cap1.get() );
+        }
+        if ( hasCap2 )
+        {
+            osg::ref_ptr<osg::DrawElementsUInt> cap2 = new osg::DrawElementsUInt( capType, 0 );
+            cap2->push_back( bodyAndCapSize );
+            for ( j=capSize; j>=1; --j )
+                cap2->push_back( bodyAndCapSize+j );
+            addPrimitiveSet( cap2.get() );
         }
-        cap2->insert( cap2->begin(), bodyAndCapSize );
-        addPrimitiveSet( cap2.get() );
     }
 
     // Attach vertics to the geometry.
@@ -135,12 +143,14 @@ void Extrude::updateImplementation()
     // Calculate normals using smoothing visitor.
     if ( getGenerateCoords()&Model::NORMAL_COORDS )
     {
-        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL );
+        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL,
+            NormalVisitor::MWE, 1e-6, true, getNumThreads() );
     }
 
     // Calculate texture coordinates.
     if ( getGenerateCoords()&Model::TEX_COORDS )
     {
+        osg::ref_ptr<osg::Vec2Array> texCoords = reuseArray<osg::Vec2Array>( getTexCoordArray(0) );
         double maxTexCoordOfBody = 1.0;
         if ( getGenerateParts()&(Model::CAP1_PART+Model::CAP2_PART) )
             maxTexCoordOfBody = 0.5;
@@ -41,7 +41,7 @@ Lathe::Lathe( const Lathe& copy, const osg::CopyOp& copyop/*=osg::CopyOp::SHALLO
     Model(copy, copyop),
     _segments(copy._segments), _radian(copy._radian), _axis(copy._axis), _origin(copy._origin)
 {
-    _profile = dynamic_cast<Curve*>( copy._profile->clone(copyop) );
+    if ( copy._profile.valid() ) _profile = dynamic_cast<Curve*>( copy._profile->clone(copyop) );
 }
 
 Lathe::~Lathe()
@@ -50,99 +50,121 @@ Lathe::~Lathe()
 
 void Lathe::updateImplementation()
 {
-    // First delete previous primitives.
-    removePrimitiveSet( 0, getPrimitiveSetList().size() );
-
     if ( !_profile || !_profile->getPath() || _profile->getPath()->size()<2 )
     {
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
         osg::notify(osg::WARN) << "osgModeling: Lathe object should have a profile with at least 2 points." <<std::endl;
         return;
     }
 
-    // Initiate vertics & texture coordinates.
-    osg::ref_ptr<osg::Vec3Array> vertics = new osg::Vec3Array;
-    osg::ref_ptr<osg::Vec2Array> texCoords = new osg::Vec2Array;
+    // Initiate vertics, refilling the existing array.
+    osg::ref_ptr<osg::Vec3Array> vertics = reuseArray<osg::Vec3Array>( getVertexArray() );
 
     double radianInterval = _radian/_segments;
 
-    // Generate vertics.
+    // Sines & cosines of all segments, shared by every point of the profile.
+    unsigned int i, j, k, numRing=_segments+1;
+    VECTOR<float> cosTable( numRing ), sinTable( numRing );
+    for ( i=0; i<numRing; ++i )
+    {
+        cosTable[i] = cos( i*radianInterval );
+        sinTable[i] = sin( i*radianInterval );
+    }
+
+    // Generate vertics. Each point is split into the axial part, which is kept, and the radial part, which
+    // rotates towards its cross product with the axis: v' = axial + radial * cosA + (v^axis) * sinA.
+    // This is the same rotation as rotateMatrix(), without building a matrix for every vertex.
+    osg::Vec3 axis = _axis;
+    axis.normalize();
     osg::Vec3Array* pts = _profile->getPath();
-    for ( osg::Vec3Array::iterator itr=pts->begin(); itr!=pts->end(); ++itr )
+    vertics->resize( pts->size()*numRing );
+    for ( k=0; k<pts->size(); ++k )
     {
-        osg::Vec3 vec = *itr;
-        vertics->push_back( vec+_origin );
+        const osg::Vec3& vec = (*pts)[k];
+        osg::Vec3 base = axis*(vec*axis);
+        osg::Vec3 radial = vec - base, tangent = vec ^ axis;
+        base += _origin;
 
-        osg::Vec3 newVec;
-        for ( unsigned int i=1; i<=_segments; ++i )
+        float* out = (*vertics)[k*numRing].ptr();
+        for ( i=0; i<numRing; ++i, out+=3 )
         {
-            if ( i==_segments && _radian==osg::PI*2 )
-            {
-                vertics->push_back( vec+_origin );
-                break;
-            }
-
-            newVec = vec * rotateMatrix( _axis, i*radianInterval );
-            vertics->push_back( newVec+_origin );
+            out[0] = base.x() + radial.x()*cosTable[i] + tangent.x()*sinTable[i];
+            out[1] = base.y() + radial.y()*cosTable[i] + tangent.y()*sinTable[i];
+            out[2] = base.z() + radial.z()*cosTable[i] + tangent.z()*sinTable[i];
         }
+
+        // The first and last points of a closed ring are exactly the same.
+        (*vertics)[k*numRing] = vec+_origin;
+        if ( _segments>0 && _radian==osg::PI*2 ) (*vertics)[k*numRing+_segments] = vec+_origin;
     }
 
-    // Create new primitives for body and 2 caps.
+    // Find centers of 2 caps.
     unsigned int profileSize = pts->size();
     unsigned int bodySize = vertics->size();
     unsigned int startOfCap2 = bodySize-_segments-1;
-    unsigned int i, j;
     osg::Vec3 topCenter, botCenter;
     osg::BoundingBox topBox, botBox;
     calcBoundAndCenter( &(vertics->front()), _segments+1, &topCenter, &topBox );
     calcBoundAndCenter( &(vertics->at(startOfCap2)), _segments+1, &botCenter, &botBox );
 
-    GLenum bodyType = osg::PrimitiveSet::QUAD_STRIP;
-    GLenum capType = osg::PrimitiveSet::TRIANGLE_FAN;
-    if ( getAuxFunctions()&Model::USE_WIREFRAME )
+    // Vertices of caps.
+    bool hasCap1 = (getGenerateParts()&Model::CAP1_PART) && _segments>2;
+    bool hasCap2 = (getGenerateParts()&Model::CAP2_PART) && _segments>2;
+    if ( hasCap1 )
     {
-        bodyType = osg::PrimitiveSet::LINES;
-        capType = osg::PrimitiveSet::LINE_STRIP;
+        vertics->push_back( topCenter );
+        for ( i=0; i<=_segments; ++i )
+            vertics->push_back( (*vertics)[i] );
+    }
+    unsigned int bodyAndCapSize = vertics->size();
+    if ( hasCap2 )
+    {
+        vertics->push_back( botCenter );
+        for ( i=startOfCap2; i<=bodySize-1; ++i )
+            vertics->push_back( (*vertics)[i] );
     }
 
-    if ( getGenerateParts()&Model::BODY_PART )
+    // Primitives are kept if only positions changed, or shared with other models of the same topology.
+    if ( !canReusePrimitives(vertics->size()) && !useSharedTopology(profileSize, _segments) )
     {
-        for ( i=0; i<profileSize-1; ++i )
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
+
+        GLenum bodyType = osg::PrimitiveSet::QUAD_STRIP;
+        GLenum capType = osg::PrimitiveSet::TRIANGLE_FAN;
+        if ( getAuxFunctions()&Model::USE_WIREFRAME )
         {
-            osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
-            for ( j=0; j<=_segments; ++j )
+            bodyType = osg::PrimitiveSet::LINES;
+            capType = osg::PrimitiveSet::LINE_STRIP;
+        }
+
+        if ( getGenerateParts()&Model::BODY_PART )
+        {
+            for ( i=0; i<profileSize-1; ++i )
             {
-                bodySeg->push_back( j+i*(_segments+1) );
-                bodySeg->push_back( j+(i+1)*(_segments+1) );
+                osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
+                for ( j=0; j<=_segments; ++j )
+                {
+                    bodySeg->push_back( j+i*(_segments+1) );
+                    bodySeg->push_back( j+(i+1)*(_segments+1) );
+                }
+                addPrimitiveSet( bodySeg.get() );
             }
-            addPrimitiveSet( bodySeg.get() );
         }
-    }
-    if ( getGenerateParts()&Model::CAP1_PART && _segments>2 )
-    {
-        osg::ref_ptr<osg::DrawElementsUInt> cap1 = new osg::DrawElementsUInt( capType, 0 );
-
-        vertics->push_back( topCenter );
-        cap1->push_back( bodySize );
-        for ( i=0, j=1; i<=_segments; ++i, ++j )
+        if ( hasCap1 )
         {
-            vertics->push_back( (*vertics)[i] );
-            cap1->push_back( bodySize+j );
+            osg::ref_ptr<osg::DrawElementsUInt> cap1 = new osg::DrawElementsUInt( capType, 0 );
+            for ( j=0; j<=_segments+1; ++j )
+                cap1->push_back( bodySize+j );
+            addPrimitiveSet( cap1.get() );
         }
-        addPrimitiveSet( cap1.get() );
-    }
-    if ( getGenerateParts()&Model::CAP2_PART && _segments>2 )
-    {
-        unsigned int bodyAndCapSize = vertics->size();
-        osg::ref_ptr<osg::DrawElementsUInt> cap2 = new osg::DrawElementsUInt( capType, 0 );
-
-        vertics->push_back( botCenter );
-        for ( i=startOfCap2, j=1; i<=bodySize-1; ++i, ++j )
+        if ( hasCap2 )
         {
-            vertics->push_back( (*vertics)[i] );
-            cap2->insert( cap2->begin(), bodyAndCapSize+j );
+            osg::ref_ptr<osg::DrawElementsUInt> cap2 = new osg::DrawElementsUInt( capType, 0 );
+            cap2->push_back( bodyAndCapSize );
+            for ( j=_segments+1; j>=1; --j )
+                cap2->push_back( bodyAndCapSize+j );
+            addPrimitiveSet( cap2.get() );
         }
-        cap2->insert( cap2->begin(), bodyAndCapSize );
-        addPrimitiveSet( cap2.get() );
     }
 
     // Attach vertics to the geometry.
@@ -151,13 +173,15 @@ void Lathe::updateImplementation()
     // Calculate normals using smoothing visitor.
     if ( getGenerateCoords()&Model::NORMAL_COORDS )
     {
-        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL );
+        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL,
+            NormalVisitor::MWE, 1e-6, true, getNumThreads() );
     }
 
     // Calculate texture coordinates.
     osg::Vec3Array::iterator itr;
     if ( getGenerateCoords()&Model::TEX_COORDS )
     {
+        osg::ref_ptr<osg::Vec2Array> texCoords = reuseArray<osg::Vec2Array>( getTexCoordArray(0) );
         double maxTexCoordOfBody = 1.0;
         if ( getGenerateParts()&(Model::CAP1_PART+Model::CAP2_PART) )
             maxTexCoordOfBody = 0.5;
@@ -212,3 +236,13 @@ void Lathe::updateImplementation()
     dirtyDisplayList();
 }
 
+Model* Lathe::createCoarseModel( double ratio )
+{
+    unsigned int segments = reduceIntervals( _segments, ratio, 3 );
+    if ( segments>=_segments ) return NULL;
+
+    // The cloned profile keeps evaluated points, so the curve itself is not sampled again.
+    Lathe* lathe = dynamic_cast<Lathe*>( clone(osg::CopyOp::SHALLOW_COPY) );
+    if ( lathe ) lathe->setLatheSegments( segments );
+    return lathe;
+}
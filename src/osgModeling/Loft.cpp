@@ -19,74 +19,87 @@
 #include <osgModeling/Loft>
 #include <osgModeling/NormalVisitor>
 #include <osgModeling/TexCoordVisitor>
+#include <algorithm>
 
 using namespace osgModeling;
 
 Loft::Loft():
     Model(),
-    _profile(0)
+    _method(0), _profile(0)
 {
 }
 
 Loft::Loft( Curve* path, Curve* shape ):
     Model(),
-    _profile(path)
+    _method(0), _profile(path)
 {
     addShape( shape );
     update();
 }
 
 Loft::Loft( const Loft& copy, const osg::CopyOp& copyop/*=osg::CopyOp::SHALLOW_COPY*/ ):
-    Model(copy, copyop), _shapes(copy._shapes)
+    Model(copy, copyop), _method(copy._method), _shapes(copy._shapes)
 {
-    _profile = dynamic_cast<Curve*>( copy._profile->clone(copyop) );
+    if ( copy._profile.valid() ) _profile = dynamic_cast<Curve*>( copy._profile->clone(copyop) );
 }
 
 Loft::~Loft()
 {
 }
 
-bool Loft::processSections( const Curve* path, Loft::Shapes& shapes )
+static osg::Vec3Array* reuseTransition( osg::ref_ptr<Curve>& transition, unsigned int size )
+{
+    if ( !transition ) transition = new Curve;
+    if ( !transition->getPath() ) transition->setPath( new osg::Vec3Array );
+
+    osg::Vec3Array* pts = transition->getPath();
+    pts->resize( size );
+    pts->dirty();
+    return pts;
+}
+
+bool Loft::processSections( const Curve* path, const Loft::Shapes& shapes, Loft::Shapes& transitions,
+                            Loft::Shapes& sections )
 {
     const osg::Vec3Array* pts = path->getPath();
     unsigned int segments = pts->size();
+    unsigned int numShapes = shapes.size()<segments ? shapes.size() : segments;
 
-    shapes.resize( segments );
+    sections.assign( shapes.begin(), shapes.begin()+numShapes );
+    sections.resize( segments );
+    transitions.resize( segments );
 
-    Loft::Shapes::iterator itr, from=shapes.begin(), to=shapes.end();
-    for ( itr=from+1; itr!=shapes.end(); ++itr )
+    unsigned int i, from=0;
+    for ( i=1; i<segments; ++i )
     {
-        Curve* c = dynamic_cast<Curve*>( (*itr).get() );
+        Curve* c = sections[i].get();
         if ( !c || !(c->getPath()) || !(c->getPath()->size()) )
             continue;
 
-        // Record and calculate transitions between two defined shapes.
-        if ( to==shapes.end() )
-        {
-            to = itr;
-            buildTransitions( from, to, &(pts->at(from-shapes.begin())) );
-
-            from = to;
-            to = shapes.end();
-        }
+        // Calculate transitions between two defined shapes.
+        buildTransitions( sections, transitions, from, i, &(pts->at(from)) );
+        from = i;
     }
-    if ( from!=shapes.end() && to==shapes.end() )
+
+    // Sections after the last defined shape are the same as it.
+    const osg::Vec3Array* fromArray = sections[from].valid() ? sections[from]->getPath() : NULL;
+    if ( !fromArray ) return false;
+    for ( i=from+1; i<segments; ++i )
     {
-        Curve* fromSect = dynamic_cast<Curve*>( (*from).get() );
-        for ( itr=from+1; itr!=shapes.end(); ++itr )
-            *itr = new Curve( *fromSect, osg::CopyOp::DEEP_COPY_ALL );
+        osg::Vec3Array* currArray = reuseTransition( transitions[i], fromArray->size() );
+        std::copy( fromArray->begin(), fromArray->end(), currArray->begin() );
+        sections[i] = transitions[i];
     }
     return true;
 }
 
-bool Loft::buildTransitions( Loft::Shapes::iterator& from, Loft::Shapes::iterator& to, const osg::Vec3* pathPtr )
+bool Loft::buildTransitions( Loft::Shapes& sections, Loft::Shapes& transitions, unsigned int from, unsigned int to,
+                             const osg::Vec3* pathPtr )
 {
-    Curve* fromSect = dynamic_cast<Curve*>( (*from).get() );
-    Curve* toSect = dynamic_cast<Curve*>( (*to).get() );
-    osg::Vec3Array* fromArray = dynamic_cast<osg::Vec3Array*>( fromSect->getPath() );
-    osg::Vec3Array* toArray = dynamic_cast<osg::Vec3Array*>( toSect->getPath() );
+    osg::Vec3Array* fromArray = sections[from].valid() ? sections[from]->getPath() : NULL;
+    osg::Vec3Array* toArray = sections[to]->getPath();
     int numToGenerate = to-from-1;
-    if ( numToGenerate<=0 ) return false;
+    if ( !fromArray || numToGenerate<=0 ) return false;
 
     // Get length of the path between 2 exist shapes..
     double maxLen = 0.0f;
@@ -98,17 +111,17 @@ bool Loft::buildTransitions( Loft::Shapes::iterator& from, Loft::Shapes::iterato
         lastPtr = currPtr;
     }
 
-    // Create and alter vertex array of each transition shape.
+    // Refill vertex array of each transition shape.
     lastPtr = pathPtr;
     toArray->resize( fromArray->size(), toArray->back() );
-    for ( Loft::Shapes::iterator itr=from+1; itr!=to; ++itr )
+    for ( unsigned int k=from+1; k<to; ++k )
     {
-        currPtr = pathPtr+(itr-from);
+        currPtr = pathPtr+(k-from);
         double lenFactor = (*currPtr - *lastPtr).length() / maxLen;
         lastPtr = currPtr;
 
-        *itr = new Curve( *fromSect, osg::CopyOp::DEEP_COPY_ALL );
-        osg::Vec3Array* currArray = dynamic_cast<osg::Vec3Array*>( (*itr)->getPath() );
+        osg::Vec3Array* currArray = reuseTransition( transitions[k], fromArray->size() );
+        sections[k] = transitions[k];
 
         osg::Vec3Array::iterator vitr=currArray->begin();
         for ( unsigned int i=0;
@@ -150,7 +163,7 @@ osg::Vec3 Loft::considerBasisX( const osg::Vec3 basisZ )
     else if ( basisZ.x()!=0.0f )
     {
         if ( osg::equivalent(basisZ.y(),0.0f) && osg::equivalent(basisZ.z(),0.0f) )
-            basisX.set( 0.0f, 0.0f, -basisZ.z() ); // basisZ is X+/X-
+            basisX.set( 0.0f, 0.0f, -basisZ.x() ); // basisZ is X+/X-
         else
         {
             basisX.set( 0.0f, 1.0f, 1.0f );
@@ -160,42 +173,15 @@ osg::Vec3 Loft::considerBasisX( const osg::Vec3 basisZ )
     return basisX;
 }
 
-void Loft::updateImplementation()
+unsigned int Loft::buildSectionsByIntersection( const Loft::Shapes& shapes, osg::Vec3Array* vertics )
 {
-    // First delete previous primitives.
-    removePrimitiveSet( 0, getPrimitiveSetList().size() );
-
-    if ( !_profile || !_profile->getPath() || _profile->getPath()->size()<2 )
-    {
-        osg::notify(osg::WARN) << "osgModeling: Loft object should have a profile with at least 2 points." << std::endl;
-        return;
-    }
-    if ( !_shapes.size() )
-    {
-        osg::notify(osg::WARN) << "osgModeling: Loft object should have at least 1 section." << std::endl;
-        return;
-    }
-
-    // Rebuild all the shapes prepared for model sections.
-    processSections( _profile.get(), _shapes );
-    if ( _shapes.size()>_profile->getPath()->size() )
-    {
-        osg::notify(osg::WARN) << "osgModeling: Loft object has " << _shapes.size() << " sections now."
-            "But only " << _profile->getPath()->size() << " may be accepted by the profile." << std::endl;
-    }
-
-    // Initiate vertics & texture coordinates.
-    osg::ref_ptr<osg::Vec3Array> vertics = new osg::Vec3Array;
-    osg::ref_ptr<osg::Vec2Array> texCoords = new osg::Vec2Array;
-
-    // Build vertex array.
     osg::ref_ptr<osg::Vec3Array> lastIntersects = new osg::Vec3Array;
     osg::Vec3Array* pts = _profile->getPath(), *lastArray=NULL;
-    unsigned int knots = _shapes.size(), i=0, j;
+    unsigned int knots = shapes.size(), i=0;
     unsigned int shapeSize = 0;
-    Loft::Shapes::iterator sitr;
-    for ( sitr=_shapes.begin();
-        sitr!=_shapes.end();
+    Loft::Shapes::const_iterator sitr;
+    for ( sitr=shapes.begin();
+        sitr!=shapes.end();
         ++sitr, ++i )
     {
         Curve* curve = dynamic_cast<Curve*>( (*sitr).get() );
@@ -264,61 +250,185 @@ void Loft::updateImplementation()
         lastArray = array;	// Record current shape to calculate change of next shape.
     }
 
-    // Create new primitives for body and 2 caps.
-    unsigned int bodySize = vertics->size();
-    unsigned int startOfCap2 = bodySize-shapeSize;
-    osg::Vec3 topCenter, botCenter;
-    osg::BoundingBox topBox, botBox;
-    calcBoundAndCenter( &(vertics->front()), shapeSize, &topCenter, &topBox );
-    calcBoundAndCenter( &(vertics->at(startOfCap2)), shapeSize, &botCenter, &botBox );
+    return shapeSize;
+}
+
+unsigned int Loft::buildSectionsByFrames( const Loft::Shapes& shapes, osg::Vec3Array* vertics )
+{
+    osg::Vec3Array* pts = _profile->getPath();
+    unsigned int knots = shapes.size(), shapeSize = 0, i, j;
 
-    GLenum bodyType = osg::PrimitiveSet::QUAD_STRIP;
-    GLenum capType = osg::PrimitiveSet::TRIANGLE_FAN;
-    if ( getAuxFunctions()&Model::USE_WIREFRAME )
+    // Use the same section normals as intersecting: the path direction at both ends, and the bisector of
+    // the neighboring segments between them. They point backwards along the path.
+    VECTOR<osg::Vec3> tangents( knots );
+    for ( i=0; i<knots; ++i )
     {
-        bodyType = osg::PrimitiveSet::LINES;
-        capType = osg::PrimitiveSet::LINE_STRIP;
+        osg::Vec3 newZ;
+        if ( i==0 ) newZ = (*pts)[i] - (*pts)[i+1];
+        else if ( i==knots-1 ) newZ = (*pts)[i-1] - (*pts)[i];
+        else
+        {
+            osg::Vec3 oldZ = (*pts)[i-1] - (*pts)[i];
+            oldZ.normalize();
+            newZ = (*pts)[i] - (*pts)[i+1];
+            newZ.normalize();
+            newZ = oldZ + newZ;
+        }
+        newZ.normalize();
+        tangents[i] = newZ;
     }
 
-    if ( getGenerateParts()&Model::BODY_PART )
+    // Axis X of the first section is the same as intersecting. It is carried to next sections with the double
+    // reflection method: reflect by the bisecting plane of the 2 path points, and then by the plane mapping
+    // the reflected tangent to the next one. This keeps the frames from twisting around the path.
+    osg::Vec3 axisX = considerBasisX( tangents[0] );
+    axisX.normalize();
+    for ( i=0; i<knots; ++i )
     {
-        for ( i=0; i<knots-1; ++i )
+        const osg::Vec3& axisZ = tangents[i];
+        if ( i>0 )
         {
-            osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
-            for ( j=0; j<shapeSize; ++j )
+            osg::Vec3 v1 = (*pts)[i] - (*pts)[i-1];
+            float c1 = v1*v1;
+            if ( c1>0.0f )
             {
-                bodySeg->push_back( j+i*shapeSize );
-                bodySeg->push_back( j+(i+1)*shapeSize );
+                osg::Vec3 reflectedX = axisX - v1*(2.0f*(v1*axisX)/c1);
+                osg::Vec3 reflectedZ = tangents[i-1] - v1*(2.0f*(v1*tangents[i-1])/c1);
+                osg::Vec3 v2 = axisZ - reflectedZ;
+                float c2 = v2*v2;
+                axisX = c2>0.0f ? reflectedX - v2*(2.0f*(v2*reflectedX)/c2) : reflectedX;
             }
-            addPrimitiveSet( bodySeg.get() );
+
+            // Remove rounding errors, which may accumulate along thousands of points.
+            axisX -= axisZ*(axisX*axisZ);
+            axisX.normalize();
+        }
+
+        Curve* curve = dynamic_cast<Curve*>( shapes[i].get() );
+        if ( !curve || !(curve->getPath()) || !(curve->getPath()->size()) )
+            continue;
+
+        // Transform the section by its frame, as coordSystemMatrix() does, in a plain loop without matrices.
+        osg::Vec3 axisY = axisZ ^ axisX;
+        const osg::Vec3& origin = (*pts)[i];
+        const osg::Vec3Array* array = curve->getPath();
+        shapeSize = array->size();
+
+        unsigned int start = vertics->size();
+        vertics->resize( start+shapeSize );
+        const float* in = array->front().ptr();
+        float* out = (*vertics)[start].ptr();
+        for ( j=0; j<shapeSize; ++j, in+=3, out+=3 )
+        {
+            out[0] = origin.x() + in[0]*axisX.x() + in[1]*axisY.x() + in[2]*axisZ.x();
+            out[1] = origin.y() + in[0]*axisX.y() + in[1]*axisY.y() + in[2]*axisZ.y();
+            out[2] = origin.z() + in[0]*axisX.z() + in[1]*axisY.z() + in[2]*axisZ.z();
         }
     }
-    if ( getGenerateParts()&Model::CAP1_PART && shapeSize>2 )
+    return shapeSize;
+}
+
+void Loft::updateImplementation()
+{
+    if ( !_profile || !_profile->getPath() || _profile->getPath()->size()<2 )
+    {
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
+        osg::notify(osg::WARN) << "osgModeling: Loft object should have a profile with at least 2 points." << std::endl;
+        return;
+    }
+    if ( !_shapes.size() )
+    {
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
+        osg::notify(osg::WARN) << "osgModeling: Loft object should have at least 1 section." << std::endl;
+        return;
+    }
+
+    if ( _shapes.size()>_profile->getPath()->size() )
     {
-        osg::ref_ptr<osg::DrawElementsUInt> cap1 = new osg::DrawElementsUInt( capType, 0 );
+        osg::notify(osg::WARN) << "osgModeling: Loft object has " << _shapes.size() << " sections now."
+            "But only " << _profile->getPath()->size() << " may be accepted by the profile." << std::endl;
+    }
+
+    // Place shapes at all points of the profile. Transitions are refilled into curves kept by the model,
+    // so shapes set by the user are not changed, and transitions follow them when they are changed.
+    processSections( _profile.get(), _shapes, _transitions, _sections );
+    const Loft::Shapes& shapes = _sections;
+
+    // Initiate vertics, refilling the existing array.
+    osg::ref_ptr<osg::Vec3Array> vertics = reuseArray<osg::Vec3Array>( getVertexArray() );
+
+    // Build vertex array.
+    osg::Vec3Array* pts = _profile->getPath();
+    unsigned int knots = shapes.size(), i, j;
+    unsigned int shapeSize = _method==1 ? buildSectionsByFrames( shapes, vertics.get() )
+        : buildSectionsByIntersection( shapes, vertics.get() );
+
+    // Find centers of 2 caps.
+    unsigned int bodySize = vertics->size();
+    unsigned int startOfCap2 = bodySize-shapeSize;
+    osg::Vec3 topCenter, botCenter;
+    osg::BoundingBox topBox, botBox;
+    calcBoundAndCenter( &(vertics->front()), shapeSize, &topCenter, &topBox );
+    calcBoundAndCenter( &(vertics->at(startOfCap2)), shapeSize, &botCenter, &botBox );
 
+    // Vertices of caps.
+    bool hasCap1 = (getGenerateParts()&Model::CAP1_PART) && shapeSize>2;
+    bool hasCap2 = (getGenerateParts()&Model::CAP2_PART) && shapeSize>2;
+    if ( hasCap1 )
+    {
         vertics->push_back( topCenter );
-        cap1->push_back( bodySize );
-        for ( i=0, j=1; i<shapeSize; ++i, ++j )
-        {
+        for ( i=0; i<shapeSize; ++i )
             vertics->push_back( (*vertics)[i] );
-            cap1->push_back( bodySize+j );
-        }
-        addPrimitiveSet( cap1.get() );
     }
-    if ( getGenerateParts()&Model::CAP2_PART && shapeSize>2 )
+    unsigned int bodyAndCapSize = vertics->size();
+    if ( hasCap2 )
     {
-        unsigned int bodyAndCapSize = vertics->size();
-        osg::ref_ptr<osg::DrawElementsUInt> cap2 = new osg::DrawElementsUInt( capType, 0 );
-
         vertics->push_back( botCenter );
-        for ( i=startOfCap2, j=1; i<=bodySize-1; ++i, ++j )
-        {
+        for ( i=startOfCap2; i<=bodySize-1; ++i )
             vertics->push_back( (*vertics)[i] );
-            cap2->insert( cap2->begin(), bodyAndCapSize+j );
+    }
+
+    // Primitives are kept if only positions changed.
+    if ( !canReusePrimitives(vertics->size()) )
+    {
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
+
+        GLenum bodyType = osg::PrimitiveSet::QUAD_STRIP;
+        GLenum capType = osg::PrimitiveSet::TRIANGLE_FAN;
+        if ( getAuxFunctions()&Model::USE_WIREFRAME )
+        {
+            bodyType = osg::PrimitiveSet::LINES;
+            capType = osg::PrimitiveSet::LINE_STRIP;
+        }
+
+        if ( getGenerateParts()&Model::BODY_PART )
+        {
+            for ( i=0; i<knots-1; ++i )
+            {
+                osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
+                for ( j=0; j<shapeSize; ++j )
+                {
+                    bodySeg->push_back( j+i*shapeSize );
+                    bodySeg->push_back( j+(i+1)*shapeSize );
+                }
+                addPrimitiveSet( bodySeg.get() );
+            }
+        }
+        if ( hasCap1 )
+        {
+            osg::ref_ptr<osg::DrawElementsUInt> cap1 = new osg::DrawElementsUInt( capType, 0 );
+            for ( j=0; j<=shapeSize; ++j )
+                cap1->push_back( bodySize+j );
+            addPrimitiveSet( cap1.get() );
+        }
+        if ( hasCap2 )
+        {
+            osg::ref_ptr<osg::DrawElementsUInt> cap2 = new osg::DrawElementsUInt( capType, 0 );
+            cap2->push_back( bodyAndCapSize );
+            for ( j=shapeSize; j>=1; --j )
+                cap2->push_back( bodyAndCapSize+j );
+            addPrimitiveSet( cap2.get() );
         }
-        cap2->insert( cap2->begin(), bodyAndCapSize );
-        addPrimitiveSet( cap2.get() );
     }
 
     // Attach vertics to the geometry.
@@ -327,13 +437,15 @@ void Loft::updateImplementation()
     // Calculate normals using smoothing visitor.
     if ( getGenerateCoords()&Model::NORMAL_COORDS )
     {
-        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL );
+        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL,
+            NormalVisitor::MWE, 1e-6, true, getNumThreads() );
     }
 
     // Calculate texture coordinates.
     osg::Vec3Array::iterator itr;
     if ( getGenerateCoords()&Model::TEX_COORDS )
     {
+        osg::ref_ptr<osg::Vec2Array> texCoords = reuseArray<osg::Vec2Array>( getTexCoordArray(0) );
         double maxTexCoordOfBody = 1.0f;
         if ( getGenerateParts()&(Model::CAP1_PART+Model::CAP2_PART) )
             maxTexCoordOfBody = 0.5f;
@@ -391,3 +503,39 @@ void Loft::updateImplementation()
 
     dirtyDisplayList();
 }
+
+Model* Loft::createCoarseModel( double ratio )
+{
+    if ( !_profile || !_profile->getPath() || !_shapes.size() )
+        return NULL;
+
+    const osg::Vec3Array* pts = _profile->getPath();
+    unsigned int numPts = pts->size();
+    if ( numPts<3 ) return NULL;
+
+    unsigned int numIntervals = reduceIntervals( numPts-1, ratio, 1 );
+    if ( numIntervals+1>=numPts ) return NULL;
+
+    // Fill transitions on the full profile first, so each kept point has the same section as this model.
+    // They are new curves owned by the copy, instead of those refilled by updates of this model.
+    Loft::Shapes shapes, transitions;
+    processSections( _profile.get(), _shapes, transitions, shapes );
+
+    osg::ref_ptr<osg::Vec3Array> coarsePts = new osg::Vec3Array( numIntervals+1 );
+    Loft::Shapes coarseShapes( numIntervals+1 );
+    for ( unsigned int i=0; i<=numIntervals; ++i )
+    {
+        unsigned int pos = (unsigned int)( (double)i*(numPts-1)/numIntervals + 0.5 );
+        (*coarsePts)[i] = (*pts)[pos];
+        coarseShapes[i] = shapes[pos];
+    }
+
+    Loft* loft = dynamic_cast<Loft*>( clone(osg::CopyOp::SHALLOW_COPY) );
+    if ( !loft ) return NULL;
+
+    Curve* profile = new Curve;
+    profile->setPath( coarsePts.get() );
+    loft->setProfile( profile );
+    loft->_shapes = coarseShapes;
+    return loft;
+}
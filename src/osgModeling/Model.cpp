@@ -0,0 +1,722 @@
+/* -*-c++-*- osgModeling - Copyright (C) 2008 Wang Rui <wangray84@gmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <cfloat>
+#include <map>
+#include <string>
+#include <vector>
+#include <typeinfo>
+#include <osg/Geode>
+#include <osg/TriangleIndexFunctor>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+#include <osgModeling/Utilities>
+#include <osgModeling/Model>
+
+using namespace osgModeling;
+
+struct AdaptiveLattice
+{
+    typedef std::pair<unsigned int, unsigned int> LatticeCoord;
+    typedef std::map<LatticeCoord, unsigned int> IndexMap;
+
+    const VECTOR<double>& _breaksU;
+    const VECTOR<double>& _breaksV;
+    unsigned int _resolution;  // Lattice steps in each knot span
+    unsigned int _base;  // Index of the first new vertex
+    IndexMap _indexMap;
+    VECTOR<double> _params;  // (u, v) pairs of all vertices
+
+    AdaptiveLattice( const VECTOR<double>& bu, const VECTOR<double>& bv, unsigned int res, unsigned int base ):
+        _breaksU(bu), _breaksV(bv), _resolution(res), _base(base)
+    {}
+
+    inline double getParam( const VECTOR<double>& breaks, unsigned int coord ) const
+    {
+        unsigned int span = coord / _resolution;
+        if ( span>=breaks.size()-1 ) return breaks.back();
+        return breaks[span] + (breaks[span+1]-breaks[span]) * (coord%_resolution) / _resolution;
+    }
+
+    unsigned int getIndex( unsigned int cu, unsigned int cv )
+    {
+        LatticeCoord coord( cu, cv );
+        IndexMap::iterator itr = _indexMap.find( coord );
+        if ( itr!=_indexMap.end() ) return itr->second;
+
+        unsigned int index = _base + _params.size()/2;
+        _params.push_back( getParam(_breaksU, cu) );
+        _params.push_back( getParam(_breaksV, cv) );
+        _indexMap[coord] = index;
+        return index;
+    }
+};
+
+bool Model::adaptiveTessellate( const VECTOR<double>& breaksU, const VECTOR<double>& breaksV,
+                               osg::Vec3Array* vertices, osg::Vec2Array* texCoords, osg::DrawElementsUInt* indices ) const
+{
+    if ( breaksU.size()<2 || breaksV.size()<2 || !vertices || !indices )
+        return false;
+
+    unsigned int i, j, a, b, c, level;
+    unsigned int numSpanU=breaksU.size()-1, numSpanV=breaksV.size()-1;
+    unsigned int maxLevel = osg::minimum( _maxSubdivision, 10u );
+
+    // Find the lowest level of each knot span which is flat enough.
+    // Points on the grid of next level are tested against lines & diagonals of the current level.
+    // Test grids of all spans not yet flat are gathered, so each level needs only a few evaluate() calls.
+    VECTOR<unsigned int> cellLevels( numSpanU*numSpanV, maxLevel );
+    VECTOR<unsigned int> pending( numSpanU*numSpanV ), remained;
+    for ( c=0; c<pending.size(); ++c ) pending[c] = c;
+
+    const unsigned int maxBatchSize = 65536;
+    VECTOR<double> params;
+    VECTOR<osg::Vec3> pts;
+    for ( level=0; level<maxLevel && !pending.empty(); ++level )
+    {
+        unsigned int n = 2<<level, size = n+1, gridSize = size*size;
+        unsigned int cellsPerBatch = osg::maximum( maxBatchSize/gridSize, 1u );
+        remained.clear();
+        for ( unsigned int first=0; first<pending.size(); first+=cellsPerBatch )
+        {
+            unsigned int numCells = osg::minimum( cellsPerBatch, (unsigned int)pending.size()-first );
+            params.resize( numCells*gridSize*2 );
+            pts.resize( numCells*gridSize );
+            for ( c=0; c<numCells; ++c )
+            {
+                i = pending[first+c] / numSpanV;
+                j = pending[first+c] % numSpanV;
+                double u0=breaksU[i], du=breaksU[i+1]-breaksU[i];
+                double v0=breaksV[j], dv=breaksV[j+1]-breaksV[j];
+                double* cellParams = &(params[c*gridSize*2]);
+                for ( a=0; a<size; ++a )
+                {
+                    for ( b=0; b<size; ++b )
+                    {
+                        cellParams[(a*size+b)*2] = u0 + du*a/n;
+                        cellParams[(a*size+b)*2+1] = v0 + dv*b/n;
+                    }
+                }
+            }
+            if ( !evaluate(&(params.front()), numCells*gridSize, &(pts.front())) )
+                return false;
+
+            for ( c=0; c<numCells; ++c )
+            {
+                const osg::Vec3* cellPts = &(pts[c*gridSize]);
+                double maxError2 = 0.0;
+                for ( a=0; a<size; ++a )
+                {
+                    for ( b=0; b<size; ++b )
+                    {
+                        osg::Vec3 expected;
+                        if ( a%2 && b%2 ) expected = (cellPts[(a-1)*size+b-1] + cellPts[(a+1)*size+b+1]) * 0.5f;
+                        else if ( a%2 ) expected = (cellPts[(a-1)*size+b] + cellPts[(a+1)*size+b]) * 0.5f;
+                        else if ( b%2 ) expected = (cellPts[a*size+b-1] + cellPts[a*size+b+1]) * 0.5f;
+                        else continue;
+                        maxError2 = osg::maximum( maxError2, (double)(cellPts[a*size+b]-expected).length2() );
+                    }
+                }
+                if ( maxError2<=_tolerance*_tolerance ) cellLevels[pending[first+c]] = level;
+                else remained.push_back( pending[first+c] );
+            }
+        }
+        pending.swap( remained );
+    }
+
+    // A shared edge uses the finer level of its 2 cells, so both sides have the same vertices on it.
+    // edgeLevelsU are edges at breaksU[i] (with constant u), and edgeLevelsV at breaksV[j].
+    VECTOR<unsigned int> edgeLevelsU( (numSpanU+1)*numSpanV, 0 ), edgeLevelsV( numSpanU*(numSpanV+1), 0 );
+    for ( i=0; i<numSpanU; ++i )
+    {
+        for ( j=0; j<numSpanV; ++j )
+        {
+            level = cellLevels[i*numSpanV+j];
+            unsigned int* e = &(edgeLevelsU[i*numSpanV+j]); *e = osg::maximum( *e, level );
+            e = &(edgeLevelsU[(i+1)*numSpanV+j]); *e = osg::maximum( *e, level );
+            e = &(edgeLevelsV[i*(numSpanV+1)+j]); *e = osg::maximum( *e, level );
+            e = &(edgeLevelsV[i*(numSpanV+1)+j+1]); *e = osg::maximum( *e, level );
+        }
+    }
+
+    // Lattice of all possible vertices, with one more level for centers of stitched quads.
+    unsigned int resolution = 2<<maxLevel;
+    unsigned int start = vertices->size();
+    AdaptiveLattice lattice( breaksU, breaksV, resolution, start );
+    VECTOR<unsigned int> polygon;
+    for ( i=0; i<numSpanU; ++i )
+    {
+        for ( j=0; j<numSpanV; ++j )
+        {
+            level = cellLevels[i*numSpanV+j];
+            unsigned int n = 1<<level, step = resolution>>level;
+            unsigned int sideSteps[4] = {
+                resolution>>edgeLevelsV[i*(numSpanV+1)+j], resolution>>edgeLevelsU[(i+1)*numSpanV+j],
+                resolution>>edgeLevelsV[i*(numSpanV+1)+j+1], resolution>>edgeLevelsU[i*numSpanV+j] };
+
+            for ( a=0; a<n; ++a )
+            {
+                for ( b=0; b<n; ++b )
+                {
+                    unsigned int u0=i*resolution+a*step, u1=u0+step;
+                    unsigned int v0=j*resolution+b*step, v1=v0+step;
+
+                    // Boundary of the quad in counter-clockwise order, with vertices of finer neighbors.
+                    polygon.clear();
+                    polygon.push_back( lattice.getIndex(u0, v0) );
+                    if ( b==0 && sideSteps[0]<step )
+                        for ( c=u0+sideSteps[0]; c<u1; c+=sideSteps[0] ) polygon.push_back( lattice.getIndex(c, v0) );
+                    polygon.push_back( lattice.getIndex(u1, v0) );
+                    if ( a==n-1 && sideSteps[1]<step )
+                        for ( c=v0+sideSteps[1]; c<v1; c+=sideSteps[1] ) polygon.push_back( lattice.getIndex(u1, c) );
+                    polygon.push_back( lattice.getIndex(u1, v1) );
+                    if ( b==n-1 && sideSteps[2]<step )
+                        for ( c=u1-sideSteps[2]; c>u0; c-=sideSteps[2] ) polygon.push_back( lattice.getIndex(c, v1) );
+                    polygon.push_back( lattice.getIndex(u0, v1) );
+                    if ( a==0 && sideSteps[3]<step )
+                        for ( c=v1-sideSteps[3]; c>v0; c-=sideSteps[3] ) polygon.push_back( lattice.getIndex(u0, c) );
+
+                    if ( polygon.size()==4 )
+                    {
+                        indices->push_back( polygon[0] ); indices->push_back( polygon[1] ); indices->push_back( polygon[2] );
+                        indices->push_back( polygon[0] ); indices->push_back( polygon[2] ); indices->push_back( polygon[3] );
+                    }
+                    else
+                    {
+                        unsigned int center = lattice.getIndex( u0+step/2, v0+step/2 );
+                        for ( c=0; c<polygon.size(); ++c )
+                        {
+                            indices->push_back( center );
+                            indices->push_back( polygon[c] );
+                            indices->push_back( polygon[(c+1)%polygon.size()] );
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Evaluate all vertices in one batch.
+    unsigned int numVertices = lattice._params.size()/2;
+    vertices->resize( start+numVertices );
+    if ( !evaluate(&(lattice._params.front()), numVertices, &((*vertices)[start])) )
+        return false;
+
+    if ( texCoords )
+    {
+        double rangeU=breaksU.back()-breaksU.front(), rangeV=breaksV.back()-breaksV.front();
+        texCoords->reserve( texCoords->size()+numVertices );
+        for ( i=0; i<numVertices; ++i )
+        {
+            texCoords->push_back( osg::Vec2(
+                (lattice._params[2*i]-breaksU.front())/rangeU, (lattice._params[2*i+1]-breaksV.front())/rangeV) );
+        }
+    }
+    return true;
+}
+
+bool Model::buildAdaptiveGeometry( const VECTOR<double>& breaksU, const VECTOR<double>& breaksV )
+{
+    // Refill existing arrays, see reuseArray().
+    osg::ref_ptr<osg::Vec3Array> vertics = reuseArray<osg::Vec3Array>( getVertexArray() );
+    osg::ref_ptr<osg::Vec2Array> texCoords = reuseArray<osg::Vec2Array>( getTexCoordArray(0) );
+    osg::ref_ptr<osg::DrawElementsUInt> triangles = new osg::DrawElementsUInt( osg::PrimitiveSet::TRIANGLES, 0 );
+    if ( !adaptiveTessellate(breaksU, breaksV, vertics.get(), texCoords.get(), triangles.get()) )
+        return false;
+
+    removePrimitiveSet( 0, getPrimitiveSetList().size() );
+    if ( getGenerateParts()&Model::BODY_PART )
+    {
+        if ( getAuxFunctions()&Model::USE_WIREFRAME )
+        {
+            osg::ref_ptr<osg::DrawElementsUInt> lines = new osg::DrawElementsUInt( osg::PrimitiveSet::LINES, 0 );
+            for ( unsigned int i=0; i+2<triangles->size(); i+=3 )
+            {
+                for ( unsigned int j=0; j<3; ++j )
+                {
+                    lines->push_back( (*triangles)[i+j] );
+                    lines->push_back( (*triangles)[i+(j+1)%3] );
+                }
+            }
+            addPrimitiveSet( lines.get() );
+        }
+        else
+            addPrimitiveSet( triangles.get() );
+    }
+
+    setVertexArray( vertics.get() );
+    if ( getGenerateCoords()&Model::NORMAL_COORDS )
+    {
+        // Build normals with triangles even in wire-frame mode.
+        // The old normal array is moved to the temporary geometry, so NormalVisitor can refill it.
+        osg::ref_ptr<osg::Geometry> geom = new osg::Geometry;
+        geom->setVertexArray( vertics.get() );
+        geom->setNormalArray( getNormalArray() );
+        setNormalArray( NULL );
+        geom->addPrimitiveSet( triangles.get() );
+        osgModeling::NormalVisitor::buildNormal( *geom, getAuxFunctions()&Model::FLIP_NORMAL,
+            NormalVisitor::MWE, 1e-6, true, getNumThreads() );
+        setNormalArray( geom->getNormalArray() );
+        setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    }
+    if ( getGenerateCoords()&Model::TEX_COORDS )
+        setTexCoordArray( 0, texCoords.get() );
+
+    dirtyDisplayList();
+    return true;
+}
+
+struct CollectTriangleIndices
+{
+    VECTOR<unsigned int>* _indices;
+
+    CollectTriangleIndices() : _indices(0) {}
+
+    inline void operator()( unsigned int i1, unsigned int i2, unsigned int i3 )
+    {
+        // Skip degenerated triangles, which are often used to connect strips.
+        if ( i1==i2 || i2==i3 || i1==i3 ) return;
+        _indices->push_back( i1 );
+        _indices->push_back( i2 );
+        _indices->push_back( i3 );
+    }
+};
+
+static osg::DrawElements* createDrawElements( GLenum mode, const VECTOR<unsigned int>& indices )
+{
+    unsigned int maxIndex = 0;
+    for ( VECTOR<unsigned int>::const_iterator itr=indices.begin(); itr!=indices.end(); ++itr )
+        maxIndex = osg::maximum( maxIndex, *itr );
+
+    if ( maxIndex<65536 )
+        return new osg::DrawElementsUShort( mode, indices.begin(), indices.end() );
+    return new osg::DrawElementsUInt( mode, indices.begin(), indices.end() );
+}
+
+void Model::mergePrimitiveSets( osg::Geometry& geom )
+{
+    osg::TriangleIndexFunctor<CollectTriangleIndices> collector;
+    VECTOR<unsigned int> triangles, lines;
+    collector._indices = &triangles;
+
+    osg::Geometry::PrimitiveSetList points;
+    osg::Geometry::PrimitiveSetList& primitives = geom.getPrimitiveSetList();
+    for ( osg::Geometry::PrimitiveSetList::iterator itr=primitives.begin(); itr!=primitives.end(); ++itr )
+    {
+        osg::PrimitiveSet* ps = itr->get();
+        unsigned int i, numIndices=ps->getNumIndices();
+        switch ( ps->getMode() )
+        {
+        case osg::PrimitiveSet::POINTS:
+            points.push_back( ps );
+            break;
+        case osg::PrimitiveSet::LINES:
+            for ( i=0; i+1<numIndices; i+=2 )
+            {
+                lines.push_back( ps->index(i) );
+                lines.push_back( ps->index(i+1) );
+            }
+            break;
+        case osg::PrimitiveSet::LINE_STRIP:
+        case osg::PrimitiveSet::LINE_LOOP:
+            for ( i=1; i<numIndices; ++i )
+            {
+                lines.push_back( ps->index(i-1) );
+                lines.push_back( ps->index(i) );
+            }
+            if ( ps->getMode()==osg::PrimitiveSet::LINE_LOOP && numIndices>2 )
+            {
+                lines.push_back( ps->index(numIndices-1) );
+                lines.push_back( ps->index(0) );
+            }
+            break;
+        default:
+            ps->accept( collector );
+            break;
+        }
+    }
+
+    geom.removePrimitiveSet( 0, primitives.size() );
+    if ( !triangles.empty() ) geom.addPrimitiveSet( createDrawElements(osg::PrimitiveSet::TRIANGLES, triangles) );
+    if ( !lines.empty() ) geom.addPrimitiveSet( createDrawElements(osg::PrimitiveSet::LINES, lines) );
+    for ( osg::Geometry::PrimitiveSetList::iterator itr=points.begin(); itr!=points.end(); ++itr )
+        geom.addPrimitiveSet( itr->get() );
+    geom.dirtyDisplayList();
+}
+
+namespace osgModeling {
+
+/** Worker thread of asynchronous updates, which rebuilds a copy of the model. */
+class ModelUpdateThread : public OpenThreads::Thread
+{
+public:
+    ModelUpdateThread( Model* model ) : _model(model), _finished(false) {}
+
+    virtual void run()
+    {
+        _model->update();
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        _finished = true;
+    }
+
+    bool isFinished()
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        return _finished;
+    }
+
+    osg::ref_ptr<Model> _model;
+
+protected:
+    OpenThreads::Mutex _mutex;
+    bool _finished;
+};
+
+}
+
+/** Primitive sets shared by models of the same topology, keyed by the class name and sizes. */
+typedef std::pair<std::string, std::vector<unsigned int> > TopologyKey;
+typedef std::map<TopologyKey, osg::Geometry::PrimitiveSetList> TopologyMap;
+static TopologyMap s_topologyMap;
+static OpenThreads::Mutex s_topologyMutex;
+
+static inline TopologyKey makeTopologyKey( const char* className, const VECTOR<unsigned int>& sizes )
+{
+    return TopologyKey( className, std::vector<unsigned int>(sizes.begin(), sizes.end()) );
+}
+
+static inline osg::Array* copyArray( osg::Array* array )
+{
+    return array ? dynamic_cast<osg::Array*>( array->clone(osg::CopyOp::DEEP_COPY_ARRAYS) ) : NULL;
+}
+
+Model::~Model()
+{
+    if ( _updateThread )
+    {
+        _updateThread->join();
+        delete _updateThread;
+    }
+}
+
+void Model::update( bool forceUpdate )
+{
+    if ( _updateThread )
+    {
+        // Keep drawing the current geometry until the background job is finished.
+        if ( !_updateThread->isFinished() )
+        {
+            if ( forceUpdate ) dirtyModel();
+            return;
+        }
+        finishAsyncUpdate();
+    }
+
+    if ( _updated && !forceUpdate )
+        return;
+
+    if ( _asyncUpdate )
+    {
+        // Classes without their own META_Object can't be cloned, and are built in this thread instead.
+        osg::ref_ptr<Model> model = dynamic_cast<Model*>( clone(osg::CopyOp::SHALLOW_COPY) );
+        if ( model.valid() && typeid(*model)==typeid(*this) )
+        {
+            // The worker only rebuilds parts marked by dirtyModel(), as a synchronous update does.
+            int flags = (forceUpdate || !_dirty) ? DIRTY_ALL : _dirty;
+            if ( (flags&DIRTY_PRIMITIVES) || _algorithmCallback.valid()
+                || ((flags&DIRTY_VERTICES) && (_funcs&OPTIMIZE_VERTEX_CACHE)) )
+                flags = DIRTY_ALL;
+
+            // Shallow copies share arrays & primitive sets with this model, which is still being drawn.
+            // A full rebuild creates new ones, otherwise the worker refills its own copies of the arrays.
+            // Primitive sets are kept only if they are not changed, so they can still be shared.
+            unsigned int i;
+            model->_asyncUpdate = false;
+            if ( flags==DIRTY_ALL )
+            {
+                model->setVertexArray( NULL );
+                model->setNormalArray( NULL );
+                for ( i=0; i<model->getNumTexCoordArrays(); ++i )
+                    model->setTexCoordArray( i, NULL );
+                model->removePrimitiveSet( 0, model->getNumPrimitiveSets() );
+            }
+            else
+            {
+                model->setVertexArray( copyArray(getVertexArray()) );
+                model->setNormalArray( copyArray(getNormalArray()) );
+                for ( i=0; i<model->getNumTexCoordArrays(); ++i )
+                    model->setTexCoordArray( i, copyArray(getTexCoordArray(i)) );
+            }
+            model->_dirty = flags;
+            model->_updated = false;
+
+            _dirty = 0;
+            _updated = true;
+            _updateThread = new ModelUpdateThread( model.get() );
+            _updateThread->start();
+            return;
+        }
+    }
+
+    // Vertices affect normals & texture coordinates, and vertices reordered for the cache can't keep old primitives.
+    int flags = _dirty;
+    if ( forceUpdate || !flags || (flags&DIRTY_PRIMITIVES) || _algorithmCallback.valid() ) flags = DIRTY_ALL;
+    if ( flags&DIRTY_VERTICES ) flags |= DIRTY_NORMALS|DIRTY_TEXCOORDS;
+    if ( (flags&DIRTY_VERTICES) && (_funcs&OPTIMIZE_VERTEX_CACHE) ) flags = DIRTY_ALL;
+
+    if ( !(flags&DIRTY_VERTICES) )
+    {
+        if ( (flags&DIRTY_NORMALS) && updateNormals() ) flags &= ~DIRTY_NORMALS;
+        if ( (flags&DIRTY_TEXCOORDS) && updateTexCoords() ) flags &= ~DIRTY_TEXCOORDS;
+        if ( flags )
+            flags = (_funcs&OPTIMIZE_VERTEX_CACHE) ? DIRTY_ALL : (DIRTY_VERTICES|DIRTY_NORMALS|DIRTY_TEXCOORDS);
+    }
+
+    if ( flags )
+    {
+        _dirty = flags;
+        _topologyKey.clear();
+        _topologyShared = false;
+        osg::Geometry::PrimitiveSetList oldPrimitives = getPrimitiveSetList();
+        if ( _algorithmCallback.valid() )
+            (*_algorithmCallback)( this );
+        else
+            updateImplementation();
+
+        // Primitive sets kept by updateImplementation() or shared by others are already merged or optimized.
+        // Rebuilt ones, and those of models which don't generate primitives, are processed again.
+        if ( ((flags&DIRTY_PRIMITIVES) || getPrimitiveSetList()!=oldPrimitives) && !_topologyShared )
+        {
+            if ( _funcs&OPTIMIZE_VERTEX_CACHE )
+            {
+                VECTOR<unsigned int> newIndices;
+                if ( VertexCacheVisitor::optimize(*this, 32, true, 0, &newIndices) )
+                    reorderVertexData( newIndices );
+            }
+            else if ( _funcs&USE_TRIANGLE_LIST )
+                mergePrimitiveSets( *this );
+
+            if ( !_topologyKey.empty() && getNumPrimitiveSets()>0 )
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_topologyMutex );
+
+                // Forget topologies which are not used by any model now.
+                for ( TopologyMap::iterator itr=s_topologyMap.begin(); itr!=s_topologyMap.end(); )
+                {
+                    if ( itr->second.front()->referenceCount()==1 ) s_topologyMap.erase( itr++ );
+                    else ++itr;
+                }
+                s_topologyMap[makeTopologyKey(className(), _topologyKey)] = getPrimitiveSetList();
+            }
+        }
+        _topologyKey.clear();
+
+        // Remove arrays left by previous updates if they are not generated any more.
+        if ( !(_coordsToGenerate&NORMAL_COORDS) && getNormalArray() ) updateNormals();
+        if ( !(_coordsToGenerate&TEX_COORDS) && getTexCoordArray(0) ) updateTexCoords();
+    }
+
+    const osg::Array* vertices = getVertexArray();
+    _numBuiltVertices = vertices ? vertices->getNumElements() : 0;
+    _dirty = 0;
+    _normalsFlipped = (_funcs&FLIP_NORMAL)!=0;
+    _updated = true;
+}
+
+void Model::setAsyncUpdate( bool async )
+{
+    if ( !async ) finishAsyncUpdate();
+    _asyncUpdate = async;
+}
+
+void Model::finishAsyncUpdate()
+{
+    if ( !_updateThread ) return;
+
+    _updateThread->join();
+    copyGeneratedData( *(_updateThread->_model) );
+    delete _updateThread;
+    _updateThread = 0;
+}
+
+osg::LOD* Model::createLOD( unsigned int numLevels, float range, double ratio )
+{
+    if ( ratio<=0.0 || ratio>=1.0 )
+    {
+        osg::notify(osg::WARN) << "osgModeling: LOD ratio " << ratio << " should be between 0 and 1." << std::endl;
+        return NULL;
+    }
+
+    osg::ref_ptr<osg::LOD> lod = new osg::LOD;
+    osg::ref_ptr<Model> model = this;
+
+    // A drawable is drawn once by each geode holding it, so move the model out of the scene into the LOD.
+    while ( getNumParents()>0 )
+    {
+        osg::Geode* parent = dynamic_cast<osg::Geode*>( getParent(0) );
+        if ( !parent || !parent->removeDrawable(this) )
+        {
+            osg::notify(osg::WARN) << "osgModeling: Model can't be removed from its parent, and will be drawn "
+                << "in the LOD as well." << std::endl;
+            break;
+        }
+    }
+
+    float minRange = 0.0f, maxRange = range;
+    for ( unsigned int i=0; i<=numLevels; ++i )
+    {
+        model->update();
+        model->finishAsyncUpdate();
+
+        // Each level is made from the previous one, so profiles & sections are sampled again only if needed.
+        osg::ref_ptr<Model> coarse = i<numLevels ? model->createCoarseModel( ratio ) : NULL;
+        osg::ref_ptr<osg::Geode> geode = new osg::Geode;
+        geode->addDrawable( model.get() );
+        lod->addChild( geode.get(), minRange, coarse.valid() ? maxRange : FLT_MAX );
+        if ( !coarse ) break;
+
+        model = coarse;
+        minRange = maxRange;
+        maxRange /= ratio;
+    }
+    return lod.release();
+}
+
+void Model::copyGeneratedData( Model& source )
+{
+    setVertexArray( source.getVertexArray() );
+    setNormalArray( source.getNormalArray() );
+    setNormalBinding( source.getNormalBinding() );
+
+    unsigned int numUnits = osg::maximum( getNumTexCoordArrays(), source.getNumTexCoordArrays() );
+    for ( unsigned int i=0; i<numUnits; ++i )
+        setTexCoordArray( i, source.getTexCoordArray(i) );
+
+    setPrimitiveSetList( source.getPrimitiveSetList() );
+    _normalsFlipped = source._normalsFlipped;
+    _numBuiltVertices = source._numBuiltVertices;
+    dirtyDisplayList();
+    dirtyBound();
+}
+
+bool Model::canReusePrimitives( unsigned int numVertices ) const
+{
+    return !(_dirty&DIRTY_PRIMITIVES) && getNumPrimitiveSets()>0 && _numBuiltVertices==numVertices;
+}
+
+bool Model::useSharedTopology( unsigned int size1, unsigned int size2 )
+{
+    _topologyKey.clear();
+    if ( !(_funcs&SHARE_TOPOLOGY) || (_funcs&OPTIMIZE_VERTEX_CACHE) ) return false;
+
+    _topologyKey.push_back( _partsToGenerate );
+    _topologyKey.push_back( _funcs&(USE_WIREFRAME|USE_TRIANGLE_LIST) );
+    _topologyKey.push_back( size1 );
+    _topologyKey.push_back( size2 );
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_topologyMutex );
+    TopologyMap::iterator itr = s_topologyMap.find( makeTopologyKey(className(), _topologyKey) );
+    if ( itr==s_topologyMap.end() ) return false;
+
+    setPrimitiveSetList( itr->second );
+    _topologyKey.clear();
+    _topologyShared = true;
+    return true;
+}
+
+bool Model::updateNormals()
+{
+    if ( !(_coordsToGenerate&NORMAL_COORDS) )
+    {
+        setNormalArray( NULL );
+        setNormalBinding( osg::Geometry::BIND_OFF );
+        dirtyDisplayList();
+        return true;
+    }
+    if ( flipNormals() ) return true;
+
+    // Normals should be built with triangles, which are not available in wire-frame mode.
+    if ( _funcs&USE_WIREFRAME ) return false;
+    NormalVisitor::buildNormal( *this, _funcs&FLIP_NORMAL, NormalVisitor::MWE, 1e-6, true, _numThreads );
+    dirtyDisplayList();
+    return true;
+}
+
+bool Model::updateTexCoords()
+{
+    if ( _coordsToGenerate&TEX_COORDS ) return false;
+
+    setTexCoordArray( 0, NULL );
+    dirtyDisplayList();
+    return true;
+}
+
+bool Model::flipNormals()
+{
+    osg::Vec3Array* normals = dynamic_cast<osg::Vec3Array*>( getNormalArray() );
+    const osg::Array* vertices = getVertexArray();
+    if ( !normals || !vertices || normals->size()!=vertices->getNumElements()
+        || getNormalBinding()!=osg::Geometry::BIND_PER_VERTEX || _normalsFlipped==((_funcs&FLIP_NORMAL)!=0) )
+        return false;
+
+    for ( osg::Vec3Array::iterator itr=normals->begin(); itr!=normals->end(); ++itr )
+        *itr = -(*itr);
+    normals->dirty();
+    dirtyDisplayList();
+    return true;
+}
+
+void Model::setGridTexCoords( unsigned int numU, unsigned int numV )
+{
+    osg::ref_ptr<osg::Vec2Array> texCoords = reuseArray<osg::Vec2Array>( getTexCoordArray(0) );
+    texCoords->resize( numU*numV );
+    double uInterval=1.0/(numU-1), vInterval=1.0f/(numV-1);
+    for ( unsigned int i=0; i<numU; ++i )
+    {
+        for ( unsigned int j=0; j<numV; ++j )
+            (*texCoords)[i*numV+j].set( uInterval*i, vInterval*j );
+    }
+    setTexCoordArray( 0, texCoords.get() );
+}
+
+osg::Vec3Array* Model::sampleGrid( const osg::Array* grid, unsigned int numU, unsigned int numV,
+                                   unsigned int coarseNumU, unsigned int coarseNumV )
+{
+    const osg::Vec3Array* vectors = dynamic_cast<const osg::Vec3Array*>( grid );
+    if ( !vectors || vectors->size()!=numU*numV || !coarseNumU || !coarseNumV ) return NULL;
+    if ( (coarseNumU==1)!=(numU==1) || (coarseNumV==1)!=(numV==1) ) return NULL;
+
+    unsigned int stepU = coarseNumU>1 ? (numU-1)/(coarseNumU-1) : 0;
+    unsigned int stepV = coarseNumV>1 ? (numV-1)/(coarseNumV-1) : 0;
+    if ( stepU*(coarseNumU-1)!=numU-1 || stepV*(coarseNumV-1)!=numV-1 ) return NULL;
+
+    osg::Vec3Array* samples = new osg::Vec3Array( coarseNumU*coarseNumV );
+    for ( unsigned int i=0; i<coarseNumU; ++i )
+    {
+        for ( unsigned int j=0; j<coarseNumV; ++j )
+            (*samples)[i*coarseNumV+j] = (*vectors)[i*stepU*numV+j*stepV];
+    }
+    return samples;
+}
+
+void ModelUpdateCallback::update( osg::NodeVisitor* /*nv*/, osg::Drawable* drawable )
+{
+    Model* model = dynamic_cast<Model*>( drawable );
+    if ( model ) model->update();
+}
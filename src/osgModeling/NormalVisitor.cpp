@@ -17,19 +17,194 @@
 
 #include <iostream>
 #include <algorithm>
-#include <osg/TriangleFunctor>
+#include <cstring>
+#include <osg/TriangleIndexFunctor>
 #include <osgModeling/Utilities>
 #include <osgModeling/Model>
 #include <osgModeling/NormalVisitor>
 
 using namespace osgModeling;
 
+static inline unsigned int hashPosition( const osg::Vec3& v )
+{
+    // Adding 0 turns -0.0 into 0.0, which compare equal but have different bits.
+    float key[3] = { v.x()+0.0f, v.y()+0.0f, v.z()+0.0f };
+    unsigned int bits[3];
+    memcpy( bits, key, sizeof(bits) );
+    return (bits[0]*73856093u) ^ (bits[1]*19349663u) ^ (bits[2]*83492791u);
+}
+
+// Find vertices at the same position with a hash table, so that they share normals.
+// Each vertex is mapped to the first vertex at its position. The table of first vertices is returned if required,
+// where empty slots are marked with the number of vertices.
+static void weldVertices( const osg::Vec3* coords, unsigned int size, VECTOR<unsigned int>& welded,
+                          VECTOR<unsigned int>* weldTable=0 )
+{
+    unsigned int i, tableSize=16;
+    while ( tableSize<size*2 ) tableSize <<= 1;
+
+    VECTOR<unsigned int> localTable;
+    VECTOR<unsigned int>& table = weldTable ? *weldTable : localTable;
+    table.assign( tableSize, size );
+    welded.resize( size );
+    for ( i=0; i<size; ++i )
+    {
+        unsigned int h = hashPosition( coords[i] );
+        for ( h&=tableSize-1; table[h]!=size; h=(h+1)&(tableSize-1) )
+        {
+            if ( coords[table[h]]==coords[i] ) break;
+        }
+        if ( table[h]==size ) table[h] = i;
+        welded[i] = table[h];
+    }
+}
+
+// Find the first vertex welded at a position in the table, where removed slots are marked with size+1.
+static unsigned int findWelded( const VECTOR<unsigned int>& table, const VECTOR<osg::Vec3>& positions,
+                                const osg::Vec3& v, unsigned int size )
+{
+    unsigned int mask = table.size()-1;
+    for ( unsigned int h=hashPosition(v)&mask; table[h]!=size; h=(h+1)&mask )
+    {
+        if ( table[h]<size && positions[table[h]]==v ) return table[h];
+    }
+    return size;
+}
+
+// Triangles are processed in fixed-size batches of structure-of-arrays, so the loops below can be vectorized.
+#define NORMAL_BATCH_SIZE 8
+
+// Approximate asin(x) for 0<=x<=1 (Abramowitz and Stegun, 4.4.46). The polynomial error is below 2e-8 radians,
+// and the absolute error is below 3e-7 radians when evaluated in float.
+static inline float fastAsin( float x )
+{
+    float p = -0.0012624911f;
+    p = p*x + 0.0066700901f;
+    p = p*x - 0.0170881256f;
+    p = p*x + 0.0308918810f;
+    p = p*x - 0.0501743046f;
+    p = p*x + 0.0889789874f;
+    p = p*x - 0.2145988016f;
+    p = p*x + 1.5707963050f;
+    return 1.5707963268f - sqrtf(1.0f-x) * p;
+}
+
+// Compute face normals & weights at 3 corners of each triangle, decided by the normal generating method.
+// Edge vectors, their lengths and the doubled area are computed once per triangle, and the sine of a corner
+// is the doubled area divided by lengths of its two edges. Triangles with indices out of range or
+// coincident vertices are marked invalid.
+static void calcTriangleBatch( int method, bool flip, const osg::Vec3* coords, unsigned int coordSize,
+                               const unsigned int* indices, unsigned int numTriangles,
+                               osg::Vec3* faceNormals, double* weights, unsigned char* valid )
+{
+    float ax[NORMAL_BATCH_SIZE], ay[NORMAL_BATCH_SIZE], az[NORMAL_BATCH_SIZE];
+    float bx[NORMAL_BATCH_SIZE], by[NORMAL_BATCH_SIZE], bz[NORMAL_BATCH_SIZE];
+    float cx[NORMAL_BATCH_SIZE], cy[NORMAL_BATCH_SIZE], cz[NORMAL_BATCH_SIZE];
+    float nx[NORMAL_BATCH_SIZE], ny[NORMAL_BATCH_SIZE], nz[NORMAL_BATCH_SIZE];
+    float l0[NORMAL_BATCH_SIZE], l1[NORMAL_BATCH_SIZE], l2[NORMAL_BATCH_SIZE], area[NORMAL_BATCH_SIZE];
+    float w0[NORMAL_BATCH_SIZE], w1[NORMAL_BATCH_SIZE], w2[NORMAL_BATCH_SIZE];
+    float sign = flip ? -1.0f : 1.0f;
+    unsigned int k;
+
+    for ( unsigned int base=0; base<numTriangles; base+=NORMAL_BATCH_SIZE )
+    {
+        unsigned int count = osg::minimum( (unsigned int)NORMAL_BATCH_SIZE, numTriangles-base );
+        for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+        {
+            // Unused and invalid lanes get a unit triangle, to avoid dividing by zero.
+            osg::Vec3 v1(0.0f,0.0f,0.0f), v2(1.0f,0.0f,0.0f), v3(0.0f,1.0f,0.0f);
+            if ( k<count )
+            {
+                const unsigned int* tri = indices + 3*(base+k);
+                unsigned char ok = (tri[0]<coordSize && tri[1]<coordSize && tri[2]<coordSize) ? 1 : 0;
+                if ( ok )
+                {
+                    const osg::Vec3& p1 = coords[tri[0]];
+                    const osg::Vec3& p2 = coords[tri[1]];
+                    const osg::Vec3& p3 = coords[tri[2]];
+                    if ( p1==p2 || p1==p3 || p2==p3 ) ok = 0;
+                    else { v1 = p1; v2 = p2; v3 = p3; }
+                }
+                valid[base+k] = ok;
+            }
+
+            // a = v2-v1, b = v3-v2, c = v3-v1
+            ax[k] = v2.x()-v1.x(); ay[k] = v2.y()-v1.y(); az[k] = v2.z()-v1.z();
+            bx[k] = v3.x()-v2.x(); by[k] = v3.y()-v2.y(); bz[k] = v3.z()-v2.z();
+            cx[k] = v3.x()-v1.x(); cy[k] = v3.y()-v1.y(); cz[k] = v3.z()-v1.z();
+        }
+
+        for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+        {
+            nx[k] = ay[k]*cz[k] - az[k]*cy[k];
+            ny[k] = az[k]*cx[k] - ax[k]*cz[k];
+            nz[k] = ax[k]*cy[k] - ay[k]*cx[k];
+            area[k] = sqrtf( nx[k]*nx[k] + ny[k]*ny[k] + nz[k]*nz[k] );
+            l0[k] = sqrtf( ax[k]*ax[k] + ay[k]*ay[k] + az[k]*az[k] );
+            l1[k] = sqrtf( bx[k]*bx[k] + by[k]*by[k] + bz[k]*bz[k] );
+            l2[k] = sqrtf( cx[k]*cx[k] + cy[k]*cy[k] + cz[k]*cz[k] );
+        }
+
+        switch ( method )
+        {
+        case NormalVisitor::MWA:
+            for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+            {
+                w0[k] = fastAsin( osg::minimum(area[k]/(l0[k]*l2[k]), 1.0f) );
+                w1[k] = fastAsin( osg::minimum(area[k]/(l1[k]*l0[k]), 1.0f) );
+                w2[k] = fastAsin( osg::minimum(area[k]/(l2[k]*l1[k]), 1.0f) );
+            }
+            break;
+        case NormalVisitor::MWSELR:
+            for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+            {
+                w0[k] = area[k]/(l0[k]*l0[k]*l2[k]*l2[k]);
+                w1[k] = area[k]/(l1[k]*l1[k]*l0[k]*l0[k]);
+                w2[k] = area[k]/(l2[k]*l2[k]*l1[k]*l1[k]);
+            }
+            break;
+        case NormalVisitor::MWAAT:
+            for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+                w0[k] = w1[k] = w2[k] = area[k];
+            break;
+        case NormalVisitor::MWELR:
+            for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+            {
+                w0[k] = 1.0f/(l0[k]*l2[k]);
+                w1[k] = 1.0f/(l1[k]*l0[k]);
+                w2[k] = 1.0f/(l2[k]*l1[k]);
+            }
+            break;
+        case NormalVisitor::MWSRELR:
+            for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+            {
+                w0[k] = 1.0f/sqrtf(l0[k]*l2[k]);
+                w1[k] = 1.0f/sqrtf(l1[k]*l0[k]);
+                w2[k] = 1.0f/sqrtf(l2[k]*l1[k]);
+            }
+            break;
+        default:
+            for ( k=0; k<NORMAL_BATCH_SIZE; ++k )
+                w0[k] = w1[k] = w2[k] = 1.0f;
+            break;
+        }
+
+        for ( k=0; k<count; ++k )
+        {
+            if ( !valid[base+k] ) continue;
+            faceNormals[base+k].set( nx[k]*sign, ny[k]*sign, nz[k]*sign );
+            weights[3*(base+k)] = w0[k];
+            weights[3*(base+k)+1] = w1[k];
+            weights[3*(base+k)+2] = w2[k];
+        }
+    }
+}
+
 struct CalcNormalFunctor
 {
-    typedef std::multiset<const osg::Vec3*, LessPtr> CoordinateSet;
+    const osg::Vec3* _coordBase;
     unsigned int _coordSize;
-    CoordinateSet _coordSet;
-    osg::Vec3* _coordBase;
+    const unsigned int* _welded;
 
     // Normal calculating variables & functions.
     bool _flip;
@@ -46,95 +221,209 @@ struct CalcNormalFunctor
         _threshold = t;
     }
 
-    inline void incNormal( const osg::Vec3& vec, const osg::Vec3& normal, double weight )
+    inline void incNormal( unsigned int pos, const osg::Vec3& normal, double weight )
     {
-        std::pair<CoordinateSet::iterator, CoordinateSet::iterator> p =
-            _coordSet.equal_range( &vec );
+        if ( _welded ) pos = _welded[pos];
 
-        for ( CoordinateSet::iterator itr=p.first; itr!=p.second; ++itr )
+        double t = normal * _lastNormalRecorder[pos];
+        if ( _threshold<1.0f )
         {
-            int pos = *itr - _coordBase;
-            double t = normal * _lastNormalRecorder[pos];
-            if ( _threshold<1.0f )
-            {
-                if ( !equivalent(_lastNormalRecorder[pos], osg::Vec3(0.0f,0.0f,0.0f)) 
-                    && t<_threshold && t>-_threshold )
-                    continue;
-            }
+            if ( !equivalent(_lastNormalRecorder[pos], osg::Vec3(0.0f,0.0f,0.0f))
+                && t<_threshold && t>-_threshold )
+                return;
+        }
 
-            osg::Vec3* nptr = _normalBase + pos;
-            *nptr += normal * weight;
-            _lastNormalRecorder[pos] = normal;
+        _normalBase[pos] += normal * weight;
+        _lastNormalRecorder[pos] = normal;
+    }
+
+    // General functions.
+    // Triangles are buffered and computed in batches, then accumulated in the original order.
+    unsigned int _batch[3*NORMAL_BATCH_SIZE];
+    unsigned int _batchSize;
+
+    void flush()
+    {
+        osg::Vec3 faceNormals[NORMAL_BATCH_SIZE];
+        double weights[3*NORMAL_BATCH_SIZE];
+        unsigned char valid[NORMAL_BATCH_SIZE];
+        calcTriangleBatch( _method, _flip, _coordBase, _coordSize, _batch, _batchSize, faceNormals, weights, valid );
+        for ( unsigned int k=0; k<_batchSize; ++k )
+        {
+            if ( !valid[k] ) continue;
+            incNormal( _batch[3*k], faceNormals[k], weights[3*k] );
+            incNormal( _batch[3*k+1], faceNormals[k], weights[3*k+1] );
+            incNormal( _batch[3*k+2], faceNormals[k], weights[3*k+2] );
         }
+        _batchSize = 0;
     }
 
     // General functions.
     CalcNormalFunctor():
-        _coordSize(0), _coordBase(0)
+        _coordBase(0), _coordSize(0), _welded(0), _batchSize(0)
     {}
 
-    void setVerticsPtr( osg::Vec3* cb, unsigned int cs )
+    void setVerticsPtr( const osg::Vec3* cb, unsigned int cs, const unsigned int* welded )
     {
         _coordSize = cs;
         _coordBase = cb;
+        _welded = welded;
+        _lastNormalRecorder.assign( cs, osg::Vec3(0.0f,0.0f,0.0f) );
+    }
 
-        osg::Vec3* vptr = cb;
-        for ( unsigned int i=0; i<cs; ++i )
-        {
-            _coordSet.insert( vptr++ );
-            _lastNormalRecorder.push_back( osg::Vec3(0.0f,0.0f,0.0f) );
-        }
+    inline void operator() ( unsigned int i1, unsigned int i2, unsigned int i3 )
+    {
+        if ( i1>=_coordSize || i2>=_coordSize || i3>=_coordSize ) return;
+
+        unsigned int* tri = _batch + 3*_batchSize;
+        tri[0] = i1; tri[1] = i2; tri[2] = i3;
+        if ( ++_batchSize==NORMAL_BATCH_SIZE ) flush();
     }
+};
 
-    inline void operator() ( const osg::Vec3& v1, const osg::Vec3& v2, const osg::Vec3& v3, bool treatVertexDataAsTemporary )
+struct CollectNormalTriangles
+{
+    VECTOR<unsigned int>* _indices;
+
+    CollectNormalTriangles() : _indices(0) {}
+
+    inline void operator()( unsigned int i1, unsigned int i2, unsigned int i3 )
     {
-        if ( treatVertexDataAsTemporary || v1==v2 || v1==v3 || v2==v3 )
-            return;
+        _indices->push_back( i1 );
+        _indices->push_back( i2 );
+        _indices->push_back( i3 );
+    }
+};
+
+// Shared data of multithreaded normal building.
+// Face normals & corner weights are computed for chunks of triangles first. Then each vertex gathers its incident
+// corners in the original triangle order, so the result is the same as the serial functor.
+struct ParallelNormalData
+{
+    const osg::Vec3* _coords;
+    unsigned int _coordSize;
+    const unsigned int* _welded;
+    const VECTOR<unsigned int>* _indices;
+    bool _flip;
+    int _method;
+    double _threshold;
 
-        double w[3]= { 1.0f, 1.0f, 1.0f };
-        switch ( _method )
+    VECTOR<osg::Vec3> _faceNormals;
+    VECTOR<double> _weights;
+    VECTOR<unsigned char> _valid;
+    VECTOR<unsigned int> _cornerOffsets;  // Incident corners of vertex v are in [offsets[v], offsets[v+1])
+    VECTOR<unsigned int> _corners;
+    osg::Vec3* _normals;
+
+    inline unsigned int weldedIndex( unsigned int i ) const { return _welded ? _welded[i] : i; }
+};
+
+class FaceNormalTask : public ParallelTask
+{
+public:
+    FaceNormalTask( ParallelNormalData* data ) : _data(data) {}
+
+    virtual void run( unsigned int begin, unsigned int end )
+    {
+        if ( begin>=end ) return;
+        calcTriangleBatch( _data->_method, _data->_flip, _data->_coords, _data->_coordSize,
+            &((*_data->_indices)[3*begin]), end-begin,
+            &(_data->_faceNormals[begin]), &(_data->_weights[3*begin]), &(_data->_valid[begin]) );
+    }
+
+protected:
+    ParallelNormalData* _data;
+};
+
+class GatherNormalTask : public ParallelTask
+{
+public:
+    GatherNormalTask( ParallelNormalData* data ) : _data(data) {}
+
+    virtual void run( unsigned int begin, unsigned int end )
+    {
+        for ( unsigned int v=begin; v<end; ++v )
         {
-        case NormalVisitor::MWA:
-            w[0] = asin( ((v2-v1)^(v3-v1)).length()/((v2-v1).length()*(v3-v1).length()) );
-            w[1] = asin( ((v3-v2)^(v1-v2)).length()/((v3-v2).length()*(v1-v2).length()) );
-            w[2] = asin( ((v1-v3)^(v2-v3)).length()/((v1-v3).length()*(v2-v3).length()) );
-            break;
-        case NormalVisitor::MWSELR:
-            w[0] = ((v2-v1)^(v3-v1)).length()/((v2-v1).length2()*(v3-v1).length2());
-            w[1] = ((v3-v2)^(v1-v2)).length()/((v3-v2).length2()*(v1-v2).length2());
-            w[2] = ((v1-v3)^(v2-v3)).length()/((v1-v3).length2()*(v2-v3).length2());
-            break;
-        case NormalVisitor::MWAAT:
-            w[0] = ((v2-v1)^(v3-v1)).length();
-            w[1] = ((v3-v2)^(v1-v2)).length();
-            w[2] = ((v1-v3)^(v2-v3)).length();
-            break;
-        case NormalVisitor::MWELR:
-            w[0] = 1/((v2-v1).length()*(v3-v1).length());
-            w[1] = 1/((v3-v2).length()*(v1-v2).length());
-            w[2] = 1/((v1-v3).length()*(v2-v3).length());
-            break;
-        case NormalVisitor::MWSRELR:
-            w[0] = 1/sqrt((v2-v1).length()*(v3-v1).length());
-            w[1] = 1/sqrt((v3-v2).length()*(v1-v2).length());
-            w[2] = 1/sqrt((v1-v3).length()*(v2-v3).length());
-            break;
-        default:
-            break;
+            if ( _data->weldedIndex(v)!=v ) continue;
+
+            osg::Vec3 normal, lastNormal;
+            for ( unsigned int c=_data->_cornerOffsets[v]; c<_data->_cornerOffsets[v+1]; ++c )
+            {
+                unsigned int corner = _data->_corners[c];
+                const osg::Vec3& faceNormal = _data->_faceNormals[corner/3];
+                double t = faceNormal * lastNormal;
+                if ( _data->_threshold<1.0f )
+                {
+                    if ( !equivalent(lastNormal, osg::Vec3(0.0f,0.0f,0.0f))
+                        && t<_data->_threshold && t>-_data->_threshold )
+                        continue;
+                }
+
+                normal += faceNormal * _data->_weights[corner];
+                lastNormal = faceNormal;
+            }
+            normal.normalize();
+            _data->_normals[v] = normal;
         }
-        
-        osg::Vec3 normal = (v2-v1)^(v3-v1) * (_flip?-1.0f:1.0f);
-        incNormal( v1, normal, w[0] );
-        incNormal( v2, normal, w[1] );
-        incNormal( v3, normal, w[2] );
     }
+
+protected:
+    ParallelNormalData* _data;
 };
 
+static void buildNormalParallel( osg::Geometry& geom, osg::Vec3Array* coords, osg::Vec3Array* normals,
+                                 const unsigned int* welded, bool flip, int method, double threshold,
+                                 unsigned int numThreads )
+{
+    VECTOR<unsigned int> indices;
+    osg::TriangleIndexFunctor<CollectNormalTriangles> collector;
+    collector._indices = &indices;
+    geom.accept( collector );
+
+    ParallelNormalData data;
+    unsigned int i, numVertices=coords->size(), numTriangles=indices.size()/3;
+    data._coords = &(coords->front());
+    data._coordSize = numVertices;
+    data._welded = welded;
+    data._indices = &indices;
+    data._flip = flip;
+    data._method = method;
+    data._threshold = threshold;
+    data._faceNormals.resize( numTriangles );
+    data._weights.resize( numTriangles*3 );
+    data._valid.resize( numTriangles );
+    data._normals = &(normals->front());
+
+    FaceNormalTask faceTask( &data );
+    parallelRun( faceTask, numTriangles, numThreads, PARALLEL_GRAIN_SIZE );
+
+    // Sort corners of valid triangles by vertices, keeping the triangle order.
+    data._cornerOffsets.assign( numVertices+1, 0 );
+    for ( i=0; i<numTriangles*3; ++i )
+    {
+        if ( data._valid[i/3] ) ++data._cornerOffsets[data.weldedIndex(indices[i])+1];
+    }
+    for ( i=0; i<numVertices; ++i )
+        data._cornerOffsets[i+1] += data._cornerOffsets[i];
+
+    VECTOR<unsigned int> filled( data._cornerOffsets.begin(), data._cornerOffsets.end()-1 );
+    data._corners.resize( data._cornerOffsets.back() );
+    for ( i=0; i<numTriangles*3; ++i )
+    {
+        if ( data._valid[i/3] ) data._corners[filled[data.weldedIndex(indices[i])]++] = i;
+    }
+
+    GatherNormalTask gatherTask( &data );
+    parallelRun( gatherTask, numVertices, numThreads, PARALLEL_GRAIN_SIZE );
+}
+
 NormalVisitor::NormalVisitor( int method, bool flip )
 {
     _threshold = 1e-6f;
     _method = method;
     _flip = flip;
+    _weld = true;
+    _numThreads = 1;
     setTraversalMode( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN );
 }
 
@@ -168,28 +457,51 @@ bool NormalVisitor::checkPrimitives( osg::Geometry& geom )
     return true;
 }
 
-void NormalVisitor::buildNormal( osg::Geometry& geom, bool flip, int method, double threshold )
+void NormalVisitor::buildNormal( osg::Geometry& geom, bool flip, int method, double threshold, bool weld,
+                                 unsigned int numThreads )
 {
     if ( !checkPrimitives(geom) ) return;
 
     osg::Vec3Array *coords = dynamic_cast<osg::Vec3Array*>( geom.getVertexArray() );
     if ( !coords || !coords->size() ) return;
 
+    // Refill the existing normal array to keep its memory & buffer object.
     osg::Vec3Array::iterator nitr;
-    osg::Vec3Array *normals = new osg::Vec3Array( coords->size() );
+    osg::Vec3Array *normals = reuseArray<osg::Vec3Array>( geom.getNormalArray() );
+    normals->resize( coords->size() );
     for ( nitr=normals->begin(); nitr!=normals->end(); ++nitr )
     {
         nitr->set( 0.0f, 0.0f, 0.0f );
     }
 
-    osg::TriangleFunctor<CalcNormalFunctor> ctf;
-    ctf.setVerticsPtr( &(coords->front()), coords->size() );
-    ctf.setNormalParameters( &(normals->front()), flip, method, threshold );
-    geom.accept( ctf );
+    // Normals are accumulated by indices of triangles, on the first vertex of each position if welding.
+    VECTOR<unsigned int> welded;
+    if ( weld ) weldVertices( &(coords->front()), coords->size(), welded );
 
-    for ( nitr=normals->begin(); nitr!=normals->end(); ++nitr )
+    unsigned int i, size=normals->size();
+    if ( numThreads!=1 )
+    {
+        buildNormalParallel( geom, coords, normals, weld ? &(welded.front()) : 0,
+            flip, method, threshold, numThreads );
+    }
+    else
+    {
+        osg::TriangleIndexFunctor<CalcNormalFunctor> ctf;
+        ctf.setVerticsPtr( &(coords->front()), coords->size(), weld ? &(welded.front()) : 0 );
+        ctf.setNormalParameters( &(normals->front()), flip, method, threshold );
+        geom.accept( ctf );
+        ctf.flush();
+
+        for ( i=0; i<size; ++i )
+        {
+            if ( weld && welded[i]!=i ) continue;
+            (*normals)[i].normalize();
+        }
+    }
+    if ( weld )
     {
-        nitr->normalize();
+        for ( i=0; i<size; ++i )
+            (*normals)[i] = (*normals)[welded[i]];
     }
 
     geom.setNormalArray( normals );
@@ -197,12 +509,270 @@ void NormalVisitor::buildNormal( osg::Geometry& geom, bool flip, int method, dou
     geom.setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
 }
 
+void NormalVisitor::clearCache()
+{
+    _cache = AdjacencyCache();
+}
+
+bool NormalVisitor::isCacheValid( const osg::Geometry& geom ) const
+{
+    const osg::Array* coords = geom.getVertexArray();
+    const osg::Geometry::PrimitiveSetList& primitives = geom.getPrimitiveSetList();
+    if ( _cache._geometry!=&geom || !coords || coords->getNumElements()!=_cache._numVertices
+        || _cache._weld!=_weld || primitives.size()!=_cache._primitiveModes.size() )
+        return false;
+
+    for ( unsigned int i=0; i<primitives.size(); ++i )
+    {
+        if ( primitives[i]->getMode()!=_cache._primitiveModes[i]
+            || primitives[i]->getNumIndices()!=_cache._primitiveSizes[i] )
+            return false;
+    }
+    return true;
+}
+
+void NormalVisitor::buildCache( osg::Geometry& geom )
+{
+    clearCache();
+    osg::Vec3Array* coords = dynamic_cast<osg::Vec3Array*>( geom.getVertexArray() );
+    if ( !coords || !coords->size() ) return;
+
+    unsigned int i, numVertices=coords->size();
+    const osg::Geometry::PrimitiveSetList& primitives = geom.getPrimitiveSetList();
+    _cache._geometry = &geom;
+    _cache._numVertices = numVertices;
+    _cache._weld = _weld;
+    for ( i=0; i<primitives.size(); ++i )
+    {
+        _cache._primitiveModes.push_back( primitives[i]->getMode() );
+        _cache._primitiveSizes.push_back( primitives[i]->getNumIndices() );
+    }
+
+    osg::TriangleIndexFunctor<CollectNormalTriangles> collector;
+    collector._indices = &(_cache._indices);
+    geom.accept( collector );
+
+    VECTOR<unsigned int>& indices = _cache._indices;
+    if ( _weld )
+    {
+        weldVertices( &(coords->front()), numVertices, _cache._welded, &(_cache._weldTable) );
+        _cache._weldedPositions.assign( coords->begin(), coords->end() );
+        _cache._weldTableLoad = 0;
+        for ( i=0; i<numVertices; ++i )
+        {
+            if ( _cache._welded[i]==i ) ++_cache._weldTableLoad;
+        }
+
+        VECTOR<unsigned int> last( numVertices, numVertices );
+        _cache._weldedNext.assign( numVertices, numVertices );
+        for ( i=0; i<numVertices; ++i )
+        {
+            unsigned int first = _cache._welded[i];
+            if ( first!=i ) _cache._weldedNext[last[first]] = i;
+            last[first] = i;
+        }
+    }
+    else
+    {
+        _cache._welded.resize( numVertices );
+        for ( i=0; i<numVertices; ++i ) _cache._welded[i] = i;
+        _cache._weldedNext.assign( numVertices, numVertices );
+    }
+
+    // Sort corners by vertices, keeping the triangle order. Triangles out of range are dropped.
+    unsigned int numCorners = indices.size() - indices.size()%3;
+    VECTOR<unsigned char> valid( numCorners/3, 1 );
+    for ( i=0; i<numCorners; ++i )
+    {
+        if ( indices[i]>=numVertices ) valid[i/3] = 0;
+    }
+
+    _cache._cornerOffsets.assign( numVertices+1, 0 );
+    for ( i=0; i<numCorners; ++i )
+    {
+        if ( valid[i/3] ) ++_cache._cornerOffsets[_cache._welded[indices[i]]+1];
+    }
+    for ( i=0; i<numVertices; ++i )
+        _cache._cornerOffsets[i+1] += _cache._cornerOffsets[i];
+
+    VECTOR<unsigned int> filled( _cache._cornerOffsets.begin(), _cache._cornerOffsets.end()-1 );
+    _cache._corners.resize( _cache._cornerOffsets.back() );
+    for ( i=0; i<numCorners; ++i )
+    {
+        if ( valid[i/3] ) _cache._corners[filled[_cache._welded[indices[i]]]++] = i;
+    }
+    _cache._marks.assign( numVertices, 0 );
+}
+
+bool NormalVisitor::reweldVertices( const osg::Vec3Array& coords, const VECTOR<unsigned int>& dirtyVertices )
+{
+    VECTOR<unsigned int>& table = _cache._weldTable;
+    VECTOR<osg::Vec3>& positions = _cache._weldedPositions;
+    unsigned int i, n, h, numVertices=coords.size(), mask=table.size()-1;
+
+    // Welded vertices may only move together, to a position where no other vertex is.
+    VECTOR<unsigned int> moved;
+    _cache.nextMarkStamp();
+    for ( i=0; i<dirtyVertices.size(); ++i )
+    {
+        unsigned int v = dirtyVertices[i];
+        if ( v>=numVertices || coords[v]==positions[v] ) continue;
+
+        unsigned int first = _cache._welded[v];
+        if ( _cache._marks[first]==_cache._markStamp ) continue;
+        _cache._marks[first] = _cache._markStamp;
+
+        for ( n=first; n<numVertices; n=_cache._weldedNext[n] )
+        {
+            if ( !(coords[n]==coords[v]) ) return false;
+        }
+        unsigned int other = findWelded( table, positions, coords[v], numVertices );
+        if ( other<numVertices && coords[other]==coords[v] ) return false;
+        moved.push_back( first );
+    }
+    if ( moved.empty() ) return true;
+
+    VECTOR<osg::Vec3> targets( moved.size() );
+    for ( i=0; i<moved.size(); ++i ) targets[i] = coords[moved[i]];
+    std::sort( targets.begin(), targets.end() );
+    for ( i=1; i<targets.size(); ++i )
+    {
+        if ( targets[i]==targets[i-1] ) return false;
+    }
+
+    // Move first vertices of the groups in the table, leaving removed marks in old slots.
+    for ( i=0; i<moved.size(); ++i )
+    {
+        unsigned int first = moved[i];
+        for ( h=hashPosition(positions[first])&mask; table[h]!=first; h=(h+1)&mask ) {}
+        table[h] = numVertices+1;
+
+        for ( n=first; n<numVertices; n=_cache._weldedNext[n] )
+            positions[n] = coords[n];
+        for ( h=hashPosition(positions[first])&mask; table[h]<numVertices; h=(h+1)&mask ) {}
+        if ( table[h]==numVertices ) ++_cache._weldTableLoad;
+        table[h] = first;
+    }
+
+    // Clean removed marks if the table is nearly full.
+    if ( _cache._weldTableLoad*4>table.size()*3 )
+    {
+        table.assign( table.size(), numVertices );
+        _cache._weldTableLoad = 0;
+        for ( i=0; i<numVertices; ++i )
+        {
+            if ( _cache._welded[i]!=i ) continue;
+            for ( h=hashPosition(positions[i])&mask; table[h]!=numVertices; h=(h+1)&mask ) {}
+            table[h] = i;
+            ++_cache._weldTableLoad;
+        }
+    }
+    return true;
+}
+
+bool NormalVisitor::updateNormal( osg::Geometry& geom, const VECTOR<unsigned int>& dirtyVertices )
+{
+    osg::Vec3Array* coords = dynamic_cast<osg::Vec3Array*>( geom.getVertexArray() );
+    osg::Vec3Array* normals = dynamic_cast<osg::Vec3Array*>( geom.getNormalArray() );
+    if ( !coords || !coords->size() ) return false;
+    if ( !normals || normals->size()!=coords->size() || geom.getNormalBinding()!=osg::Geometry::BIND_PER_VERTEX )
+    {
+        buildNormal( geom, _flip, _method, _threshold, _weld, _numThreads );
+        return true;
+    }
+    unsigned int i, c, k, numVertices=coords->size();
+    const VECTOR<unsigned int>* moved = &dirtyVertices;
+    VECTOR<unsigned int> rewelded;
+    if ( !isCacheValid(geom) )
+    {
+        // Vertices welded with moved ones are not known, so all normals are rebuilt.
+        buildCache( geom );
+        if ( _weld )
+        {
+            buildNormal( geom, _flip, _method, _threshold, _weld, _numThreads );
+            return true;
+        }
+    }
+    else if ( _weld && !reweldVertices(*coords, dirtyVertices) )
+    {
+        // Vertices welded with moved ones before lose or get faces too.
+        rewelded.assign( dirtyVertices.begin(), dirtyVertices.end() );
+        for ( i=0; i<dirtyVertices.size(); ++i )
+        {
+            if ( dirtyVertices[i]>=numVertices ) continue;
+            for ( k=_cache._welded[dirtyVertices[i]]; k<numVertices; k=_cache._weldedNext[k] )
+                rewelded.push_back( k );
+        }
+        buildCache( geom );
+        moved = &rewelded;
+    }
+
+    // Find first vertices of all positions sharing faces with moved vertices.
+    const VECTOR<unsigned int>& indices = _cache._indices;
+    const VECTOR<unsigned int>& welded = _cache._welded;
+    VECTOR<unsigned int> affected;
+    _cache.nextMarkStamp();
+    for ( i=0; i<moved->size(); ++i )
+    {
+        if ( (*moved)[i]>=numVertices ) continue;
+
+        unsigned int v = welded[(*moved)[i]];
+        for ( c=_cache._cornerOffsets[v]; c<_cache._cornerOffsets[v+1]; ++c )
+        {
+            const unsigned int* tri = &(indices[_cache._corners[c]/3*3]);
+            for ( k=0; k<3; ++k )
+            {
+                unsigned int r = welded[tri[k]];
+                if ( _cache._marks[r]==_cache._markStamp ) continue;
+                _cache._marks[r] = _cache._markStamp;
+                affected.push_back( r );
+            }
+        }
+    }
+
+    // Recalculate these normals from incident faces in the original order, like the serial functor.
+    const osg::Vec3* vptr = &(coords->front());
+    for ( i=0; i<affected.size(); ++i )
+    {
+        unsigned int v = affected[i];
+        osg::Vec3 normal, lastNormal;
+        for ( c=_cache._cornerOffsets[v]; c<_cache._cornerOffsets[v+1]; ++c )
+        {
+            unsigned int corner = _cache._corners[c];
+            osg::Vec3 faceNormal;
+            double w[3];
+            unsigned char valid;
+            calcTriangleBatch( _method, _flip, vptr, numVertices, &(indices[corner/3*3]), 1, &faceNormal, w, &valid );
+            if ( !valid ) continue;
+
+            double t = faceNormal * lastNormal;
+            if ( _threshold<1.0f )
+            {
+                if ( !equivalent(lastNormal, osg::Vec3(0.0f,0.0f,0.0f))
+                    && t<_threshold && t>-_threshold )
+                    continue;
+            }
+
+            normal += faceNormal * w[corner%3];
+            lastNormal = faceNormal;
+        }
+        normal.normalize();
+
+        for ( unsigned int n=v; n<numVertices; n=_cache._weldedNext[n] )
+            (*normals)[n] = normal;
+    }
+
+    normals->dirty();
+    geom.dirtyDisplayList();
+    return true;
+}
+
 void NormalVisitor::apply(osg::Geode& geode)
 {
     for(unsigned int i = 0; i < geode.getNumDrawables(); i++ )
     {
       osg::Geometry* geom = dynamic_cast<osg::Geometry*>( geode.getDrawable(i) );
-      if ( geom ) buildNormal( *geom, _flip, _method, _threshold );
+      if ( geom ) buildNormal( *geom, _flip, _method, _threshold, _weld, _numThreads );
     }
 }
 
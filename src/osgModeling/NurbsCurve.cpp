@@ -19,6 +19,9 @@
 #include <functional>
 #include <osgModeling/Utilities>
 #include <osgModeling/Nurbs>
+#ifdef OSGMODELING_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace osgModeling;
 
@@ -32,9 +35,9 @@ NurbsCurve::NurbsCurve( const NurbsCurve& copy, const osg::CopyOp& copyop/*=osg:
     osgModeling::Curve(copy,copyop),
     _method(copy._method), _degree(copy._degree), _numPath(copy._numPath)
 {
-    _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
-    _knots = dynamic_cast<osg::DoubleArray*>( copy._knots->clone(copyop) );
-    _weights = dynamic_cast<osg::DoubleArray*>( copy._weights->clone(copyop) );
+    if ( copy._ctrlPts.valid() ) _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
+    if ( copy._knots.valid() ) _knots = dynamic_cast<osg::DoubleArray*>( copy._knots->clone(copyop) );
+    if ( copy._weights.valid() ) _weights = dynamic_cast<osg::DoubleArray*>( copy._weights->clone(copyop) );
 }
 
 NurbsCurve::NurbsCurve( osg::Vec3Array* pts, osg::DoubleArray* weights, osg::DoubleArray* knots,
@@ -96,6 +99,86 @@ osg::DoubleArray* NurbsCurve::generateKnots( unsigned int k, unsigned int numCtr
     return knots;
 }
 
+unsigned int NurbsCurve::findSpan( const osg::DoubleArray* knots, unsigned int k, unsigned int numCtrl, double u )
+{
+    // Binary search in [k, numCtrl-1], see "The NURBS Book" (Piegl & Tiller, 1997), algorithm A2.1.
+    unsigned int low=k, high=numCtrl;
+    if ( u>=(*knots)[numCtrl] ) return numCtrl-1;
+    if ( u<=(*knots)[k] ) return k;
+
+    unsigned int mid = (low+high)/2;
+    while ( u<(*knots)[mid] || u>=(*knots)[mid+1] )
+    {
+        if ( u<(*knots)[mid] ) high = mid;
+        else low = mid;
+        mid = (low+high)/2;
+    }
+    return mid;
+}
+
+void NurbsCurve::basisFunctions( const osg::DoubleArray* knots, unsigned int span, unsigned int k, double u, double* basis )
+{
+    // Only values of the current span are kept, so the triangular table is calculated in place.
+    double leftBuffer[16], rightBuffer[16];
+    VECTOR<double> heapBuffer;
+    double *left=leftBuffer, *right=rightBuffer;
+    if ( k>=16 )
+    {
+        heapBuffer.resize( 2*(k+1) );
+        left = &(heapBuffer.front());
+        right = left + k+1;
+    }
+
+    basis[0] = 1.0;
+    for ( unsigned int j=1; j<=k; ++j )
+    {
+        left[j] = u - (*knots)[span+1-j];
+        right[j] = (*knots)[span+j] - u;
+
+        double saved = 0.0;
+        for ( unsigned int r=0; r<j; ++r )
+        {
+            double base = right[r+1] + left[j-r];
+            double temp = base ? basis[r]/base : 0.0;
+            basis[r] = saved + right[r+1]*temp;
+            saved = left[j-r]*temp;
+        }
+        basis[j] = saved;
+    }
+}
+
+void NurbsCurve::basisDerivatives( const osg::DoubleArray* knots, unsigned int span, unsigned int k, double u, double* derivs )
+{
+    if ( !k )
+    {
+        derivs[0] = 0.0;
+        return;
+    }
+
+    // N'(i,k) = k * ( N(i,k-1)/(t[i+k]-t[i]) - N(i+1,k-1)/(t[i+k+1]-t[i+1]) ),
+    // where N(span-k+1,k-1) ... N(span,k-1) are the only non-vanishing lower-degree functions.
+    double lowerBuffer[16];
+    VECTOR<double> heapBuffer;
+    double* lower = lowerBuffer;
+    if ( k>16 )
+    {
+        heapBuffer.resize( k );
+        lower = &(heapBuffer.front());
+    }
+    basisFunctions( knots, span, k-1, u, lower );
+
+    for ( unsigned int j=0; j<=k; ++j )
+    {
+        unsigned int i = span-k+j;
+        double d = 0.0, base;
+        if ( j>0 && 0.0!=(base=(*knots)[i+k]-(*knots)[i]) )
+            d += lower[j-1] / base;
+        if ( j<k && 0.0!=(base=(*knots)[i+k+1]-(*knots)[i+1]) )
+            d -= lower[j] / base;
+        derivs[j] = d * k;
+    }
+}
+
 void NurbsCurve::updateImplementation()
 {
     if ( !_ctrlPts ) return;
@@ -122,6 +205,10 @@ void NurbsCurve::updateImplementation()
         _knots->resize( _degree+numCtrl+1, _knots->back() );
     }
 
+    // Prepare weighted control points for evaluate() & adaptive sampling.
+    if ( _weights->size()>=numCtrl )
+        _ctrlNetCache.build( _ctrlPts.get(), _weights.get(), numCtrl );
+
     if ( !_numPath )
     {
         osg::notify(osg::WARN) << "osgModeling: Invalid parameters to create a NURBS curve." << std::endl;
@@ -135,7 +222,18 @@ void NurbsCurve::updateImplementation()
     }
 
     osg::ref_ptr<osg::Vec3Array> pathArray = new osg::Vec3Array;
-    if ( _method==0 ) useCoxDeBoor( pathArray.get() );
+    if ( isAdaptive() )
+    {
+        // Distinct knots in the domain, where derivatives may be discontinuous.
+        VECTOR<double> breaks;
+        for ( unsigned int i=_degree; i<=numCtrl; ++i )
+        {
+            if ( breaks.empty() || (*_knots)[i]>breaks.back() )
+                breaks.push_back( (*_knots)[i] );
+        }
+        adaptiveSample( breaks, pathArray.get() );
+    }
+    else if ( _method==0 ) useCoxDeBoor( pathArray.get() );
     else if ( _method==1 ) useDeBoor( pathArray.get() );
     setPath( pathArray.get() );
 }
@@ -240,6 +338,168 @@ void NurbsCurve::coxDeBoor( osg::DoubleArray* basis, int m, int num, double u )
         (*basis)[i] *= (*_weights)[i] * sum;
 }
 
+bool NurbsCurve::evaluate( const double* params, unsigned int n, osg::Vec3* out ) const
+{
+    if ( !_ctrlPts || !_knots || !params || !out || _knots->size()<=_degree+1 )
+        return false;
+
+    unsigned int i, lane, start, k=_degree, order=_degree+1;
+    unsigned int numCtrl = _knots->size()-_degree-1;
+    if ( _ctrlPts->size()<numCtrl || (_weights.valid() && _weights->size()<numCtrl) )
+        return false;
+
+    // Use homogeneous control points prepared by update(), or convert them for this call only.
+    ControlNetCache localNet;
+    const ControlNetCache* net = &_ctrlNetCache;
+    if ( !_ctrlNetCache.valid(_ctrlPts.get(), _weights.get(), numCtrl) )
+    {
+        localNet.build( _ctrlPts.get(), _weights.get(), numCtrl );
+        net = &localNet;
+    }
+    const double *px=&(net->_x.front()), *py=&(net->_y.front()), *pz=&(net->_z.front()), *pw=&(net->_w.front());
+
+    // Small batches should not allocate, so basis values of usual degrees are kept on the stack.
+    const unsigned int block = EVALUATE_BLOCK_SIZE;
+    double basisBuffer[16*EVALUATE_BLOCK_SIZE], valueBuffer[16];
+    VECTOR<double> heapBuffer;
+    double *basis=basisBuffer, *values=valueBuffer;
+    if ( order>16 )
+    {
+        heapBuffer.resize( order*(block+1) );
+        basis = &(heapBuffer.front());
+        values = basis + order*block;
+    }
+
+    double minU=(*_knots)[k], maxU=(*_knots)[numCtrl];
+    unsigned int first[EVALUATE_BLOCK_SIZE];
+    double x[EVALUATE_BLOCK_SIZE], y[EVALUATE_BLOCK_SIZE], z[EVALUATE_BLOCK_SIZE], w[EVALUATE_BLOCK_SIZE];
+    for ( start=0; start<n; start+=block )
+    {
+        unsigned int num = osg::minimum( block, n-start );
+        for ( lane=0; lane<block; ++lane )
+        {
+            double u = lane<num ? osg::clampBetween(params[start+lane], minU, maxU) : minU;
+            unsigned int span = findSpan( _knots.get(), k, numCtrl, u );
+            basisFunctions( _knots.get(), span, k, u, values );
+
+            first[lane] = span-k;
+            for ( i=0; i<order; ++i )
+                basis[i*block+lane] = values[i];
+        }
+
+#ifdef OSGMODELING_USE_SSE2
+        // Two lanes in each register. Spans of lanes may differ, so their control points are loaded separately.
+        for ( lane=0; lane<block; lane+=2 )
+        {
+            __m128d sx=_mm_setzero_pd(), sy=_mm_setzero_pd(), sz=_mm_setzero_pd(), sw=_mm_setzero_pd();
+            const unsigned int first0=first[lane], first1=first[lane+1];
+            for ( i=0; i<order; ++i )
+            {
+                __m128d b = _mm_loadu_pd( basis+i*block+lane );
+                sx = _mm_add_pd( sx, _mm_mul_pd(_mm_set_pd(px[first1+i], px[first0+i]), b) );
+                sy = _mm_add_pd( sy, _mm_mul_pd(_mm_set_pd(py[first1+i], py[first0+i]), b) );
+                sz = _mm_add_pd( sz, _mm_mul_pd(_mm_set_pd(pz[first1+i], pz[first0+i]), b) );
+                sw = _mm_add_pd( sw, _mm_mul_pd(_mm_set_pd(pw[first1+i], pw[first0+i]), b) );
+            }
+            _mm_storeu_pd( x+lane, sx );
+            _mm_storeu_pd( y+lane, sy );
+            _mm_storeu_pd( z+lane, sz );
+            _mm_storeu_pd( w+lane, sw );
+        }
+#else
+        for ( lane=0; lane<block; ++lane )
+            x[lane] = y[lane] = z[lane] = w[lane] = 0.0;
+        for ( i=0; i<order; ++i )
+        {
+            for ( lane=0; lane<block; ++lane )
+            {
+                unsigned int index = first[lane]+i;
+                double b = basis[i*block+lane];
+                x[lane] += px[index] * b;
+                y[lane] += py[index] * b;
+                z[lane] += pz[index] * b;
+                w[lane] += pw[index] * b;
+            }
+        }
+#endif
+
+        for ( lane=0; lane<num; ++lane )
+        {
+            if ( w[lane] )
+                out[start+lane].set( x[lane]/w[lane], y[lane]/w[lane], z[lane]/w[lane] );
+            else
+                out[start+lane].set( 0.0f, 0.0f, 0.0f );
+        }
+    }
+    return true;
+}
+
+bool NurbsCurve::ControlNetCache::valid( const osg::Vec3Array* pts, const osg::DoubleArray* weights, unsigned int numCtrl ) const
+{
+    if ( !pts || pts!=_ctrlPts || weights!=_weights || !numCtrl || numCtrl!=_numCtrl )
+        return false;
+    if ( pts->getModifiedCount()!=_ctrlPtsModified || (weights && weights->getModifiedCount()!=_weightsModified) )
+        return false;
+    return pts->size()>=numCtrl && (!weights || weights->size()>=numCtrl);
+}
+
+void NurbsCurve::ControlNetCache::build( const osg::Vec3Array* pts, const osg::DoubleArray* weights, unsigned int numCtrl )
+{
+    _ctrlPts = pts;
+    _weights = weights;
+    _ctrlPtsModified = pts->getModifiedCount();
+    _weightsModified = weights ? weights->getModifiedCount() : 0;
+    _numCtrl = numCtrl;
+
+    _x.resize( numCtrl );
+    _y.resize( numCtrl );
+    _z.resize( numCtrl );
+    _w.resize( numCtrl );
+    for ( unsigned int i=0; i<numCtrl; ++i )
+    {
+        double w = weights ? (*weights)[i] : 1.0;
+        _x[i] = (*pts)[i].x() * w;
+        _y[i] = (*pts)[i].y() * w;
+        _z[i] = (*pts)[i].z() * w;
+        _w[i] = w;
+    }
+}
+
+bool NurbsCurve::BasisCache::valid( const osg::DoubleArray* knots, unsigned int k, unsigned int numCtrl, unsigned int numPath ) const
+{
+    if ( !knots || k!=_degree || numCtrl!=_numCtrl || numPath!=_numPath || knots->size()!=_knots.size() )
+        return false;
+    for ( unsigned int i=0; i<_knots.size(); ++i )
+    {
+        if ( (*knots)[i]!=_knots[i] ) return false;
+    }
+    return true;
+}
+
+void NurbsCurve::BasisCache::build( const osg::DoubleArray* knots, unsigned int k, unsigned int numCtrl, unsigned int numPath )
+{
+    unsigned int i, order=k+1;
+    _knots.resize( knots->size() );
+    for ( i=0; i<knots->size(); ++i )
+        _knots[i] = (*knots)[i];
+    _degree = k;
+    _numCtrl = numCtrl;
+    _numPath = numPath;
+
+    double minU=(*knots)[k];
+    double interval = numPath>1 ? ((*knots)[numCtrl]-minU)/(numPath-1) : 0.0;
+    _spans.resize( numPath );
+    _basis.resize( numPath*order );
+    _derivs.resize( numPath*order );
+    for ( i=0; i<numPath; ++i )
+    {
+        double u = minU + i*interval;
+        _spans[i] = findSpan( knots, k, numCtrl, u );
+        basisFunctions( knots, _spans[i], k, u, &(_basis[i*order]) );
+        basisDerivatives( knots, _spans[i], k, u, &(_derivs[i*order]) );
+    }
+}
+
 osg::Vec4 NurbsCurve::lerpRecursion( unsigned int k, unsigned int r, unsigned int i, double u )
 {
     if ( r==0 )
@@ -254,3 +514,173 @@ osg::Vec4 NurbsCurve::lerpRecursion( unsigned int k, unsigned int r, unsigned in
         lerpRecursion(k, r-1, i, u),
         delta );
 }
+
+void NurbsCurve::refineKnotVector( unsigned int k, const osg::DoubleArray* knots, const VECTOR<osg::Vec4d>& ctrlPtsW,
+                                  const VECTOR<double>& newKnots, osg::DoubleArray* resultKnots, VECTOR<osg::Vec4d>& resultPtsW )
+{
+    int p=k, n=(int)ctrlPtsW.size()-1, m=n+p+1, r=(int)newKnots.size()-1, j, l;
+    if ( r<0 )
+    {
+        resultKnots->assign( knots->begin(), knots->end() );
+        resultPtsW.assign( ctrlPtsW.begin(), ctrlPtsW.end() );
+        return;
+    }
+
+    const osg::DoubleArray& U = *knots;
+    const VECTOR<double>& X = newKnots;
+    int a = findSpan( knots, k, n+1, X[0] );
+    int b = findSpan( knots, k, n+1, X[r] ) + 1;
+
+    resultKnots->resize( m+r+2 );
+    resultPtsW.resize( n+r+2 );
+    osg::DoubleArray& Ubar = *resultKnots;
+    VECTOR<osg::Vec4d>& Qw = resultPtsW;
+
+    for ( j=0; j<=a-p; ++j ) Qw[j] = ctrlPtsW[j];
+    for ( j=b-1; j<=n; ++j ) Qw[j+r+1] = ctrlPtsW[j];
+    for ( j=0; j<=a; ++j ) Ubar[j] = U[j];
+    for ( j=b+p; j<=m; ++j ) Ubar[j+r+1] = U[j];
+
+    int i=b+p-1, s=b+p+r;
+    for ( j=r; j>=0; --j )
+    {
+        while ( X[j]<=U[i] && i>a )
+        {
+            Qw[s-p-1] = ctrlPtsW[i-p-1];
+            Ubar[s] = U[i];
+            --s; --i;
+        }
+
+        Qw[s-p-1] = Qw[s-p];
+        for ( l=1; l<=p; ++l )
+        {
+            int ind = s-p+l;
+            double alpha = Ubar[s+l] - X[j];
+            if ( alpha==0.0 )
+                Qw[ind-1] = Qw[ind];
+            else
+            {
+                alpha /= Ubar[s+l] - U[i-p+l];
+                Qw[ind-1] = Qw[ind-1]*alpha + Qw[ind]*(1.0-alpha);
+            }
+        }
+        Ubar[s] = X[j];
+        --s;
+    }
+}
+
+void NurbsCurve::getBezierKnots( unsigned int k, unsigned int numCtrl, const osg::DoubleArray* knots, VECTOR<double>& newKnots )
+{
+    unsigned int i=k;
+    while ( i<=numCtrl )
+    {
+        double value = (*knots)[i];
+        unsigned int multiplicity = 0;
+        for ( unsigned int j=0; j<knots->size(); ++j )
+        {
+            if ( (*knots)[j]==value ) ++multiplicity;
+        }
+        for ( ; multiplicity<k; ++multiplicity )
+            newKnots.push_back( value );
+        while ( i<=numCtrl && (*knots)[i]==value ) ++i;
+    }
+}
+
+bool NurbsCurve::getHomogeneousPoints( VECTOR<osg::Vec4d>& ptsW ) const
+{
+    if ( !_ctrlPts || !_knots || _knots->size()<=_degree+1 )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Control points and knot vector of the NURBS curve should be set first." << std::endl;
+        return false;
+    }
+
+    unsigned int numCtrl = _knots->size()-_degree-1;
+    if ( _ctrlPts->size()<numCtrl || (_weights.valid() && _weights->size()<numCtrl) )
+    {
+        osg::notify(osg::WARN) << "osgModeling: The knot vector of the NURBS curve needs " << numCtrl
+            << " control points and weights." << std::endl;
+        return false;
+    }
+
+    ptsW.resize( numCtrl );
+    for ( unsigned int i=0; i<numCtrl; ++i )
+    {
+        double w = _weights.valid() ? (*_weights)[i] : 1.0;
+        ptsW[i] = osg::Vec4d( osg::Vec3d((*_ctrlPts)[i])*w, w );
+    }
+    return true;
+}
+
+void NurbsCurve::setHomogeneousPoints( const VECTOR<osg::Vec4d>& ptsW )
+{
+    if ( !_weights ) _weights = new osg::DoubleArray;
+    _ctrlPts->resize( ptsW.size() );
+    _weights->resize( ptsW.size() );
+    for ( unsigned int i=0; i<ptsW.size(); ++i )
+    {
+        double w = ptsW[i].w();
+        (*_weights)[i] = w;
+        if ( w ) (*_ctrlPts)[i].set( ptsW[i].x()/w, ptsW[i].y()/w, ptsW[i].z()/w );
+    }
+    _ctrlNetCache.clear();
+    if (_updated) _updated=false;
+}
+
+void NurbsCurve::insertKnot( double u, unsigned int times )
+{
+    VECTOR<double> newKnots( times, u );
+    refineKnots( newKnots );
+}
+
+void NurbsCurve::refineKnots( const VECTOR<double>& newKnots )
+{
+    VECTOR<osg::Vec4d> ptsW, resultPtsW;
+    if ( newKnots.empty() || !getHomogeneousPoints(ptsW) ) return;
+
+    unsigned int numCtrl = ptsW.size();
+    if ( newKnots.front()<(*_knots)[_degree] || newKnots.back()>(*_knots)[numCtrl] )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Knots to insert should be inside the domain of the NURBS curve." << std::endl;
+        return;
+    }
+
+    osg::ref_ptr<osg::DoubleArray> resultKnots = new osg::DoubleArray;
+    refineKnotVector( _degree, _knots.get(), ptsW, newKnots, resultKnots.get(), resultPtsW );
+    _knots->assign( resultKnots->begin(), resultKnots->end() );
+    setHomogeneousPoints( resultPtsW );
+}
+
+unsigned int NurbsCurve::extractBezier( BezierSegments& segments, osg::DoubleArray* weights ) const
+{
+    VECTOR<osg::Vec4d> ptsW, resultPtsW;
+    if ( !getHomogeneousPoints(ptsW) ) return 0;
+
+    VECTOR<double> newKnots;
+    osg::ref_ptr<osg::DoubleArray> resultKnots = new osg::DoubleArray;
+    getBezierKnots( _degree, ptsW.size(), _knots.get(), newKnots );
+    refineKnotVector( _degree, _knots.get(), ptsW, newKnots, resultKnots.get(), resultPtsW );
+
+    // Every non-empty span [t(i), t(i+1)) is now a Bezier segment defined by points i-k ... i.
+    unsigned int i, j, numSegments=0, numCtrl=resultPtsW.size();
+    for ( i=_degree; i<numCtrl; ++i )
+    {
+        if ( (*resultKnots)[i]<(*resultKnots)[i+1] ) ++numSegments;
+    }
+
+    unsigned int numPath = osg::maximum( _numPath/osg::maximum(numSegments, 1u)+1, 2u );
+    for ( i=_degree; i<numCtrl; ++i )
+    {
+        if ( (*resultKnots)[i]>=(*resultKnots)[i+1] ) continue;
+
+        osg::ref_ptr<osg::Vec3Array> pts = new osg::Vec3Array;
+        for ( j=i-_degree; j<=i; ++j )
+        {
+            double w = resultPtsW[j].w();
+            if ( w ) pts->push_back( osg::Vec3(resultPtsW[j].x()/w, resultPtsW[j].y()/w, resultPtsW[j].z()/w) );
+            else pts->push_back( osg::Vec3(0.0f, 0.0f, 0.0f) );
+            if ( weights ) weights->push_back( w );
+        }
+        segments.push_back( new BezierCurve(pts.get(), _degree, numPath) );
+    }
+    return numSegments;
+}
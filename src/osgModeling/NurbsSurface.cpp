@@ -17,16 +17,20 @@
 
 #include <algorithm>
 #include <functional>
+#include <osg/Vec4d>
 #include <osgModeling/Utilities>
 #include <osgModeling/Nurbs>
 #include <osgModeling/NormalVisitor>
 #include <osgModeling/TexCoordVisitor>
+#ifdef OSGMODELING_USE_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace osgModeling;
 
 NurbsSurface::NurbsSurface():
     osgModeling::Model(),
-    _ctrlPts(0), _weights(0), _knotsU(0), _knotsV(0),
+    _method(0), _generateTangents(false), _ctrlPts(0), _weights(0), _knotsU(0), _knotsV(0),
     _degreeU(3), _degreeV(3), _numPathU(10), _numPathV(10),
     _ctrlRow(1), _ctrlCol(1)
 {
@@ -34,20 +38,24 @@ NurbsSurface::NurbsSurface():
 
 NurbsSurface::NurbsSurface( const NurbsSurface& copy, const osg::CopyOp& copyop/*=osg::CopyOp::SHALLOW_COPY*/ ):
     osgModeling::Model(copy,copyop),
-    _degreeU(copy._degreeU), _degreeV(copy._degreeV), _numPathU(copy._numPathU), _numPathV(copy._numPathV),
-    _ctrlRow(copy._ctrlRow), _ctrlCol(copy._ctrlCol)
+    _method(copy._method), _generateTangents(copy._generateTangents), _degreeU(copy._degreeU), _degreeV(copy._degreeV), _numPathU(copy._numPathU), _numPathV(copy._numPathV),
+    _ctrlRow(copy._ctrlRow), _ctrlCol(copy._ctrlCol), _tangents(copy._tangents),
+    _sampledVertices(copy._sampledVertices), _sampledNormals(copy._sampledNormals), _sampledTangents(copy._sampledTangents),
+    _basisCacheU(copy._basisCacheU), _basisCacheV(copy._basisCacheV)
 {
-    _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
-    _knotsU = dynamic_cast<osg::DoubleArray*>( copy._knotsU->clone(copyop) );
-    _knotsV = dynamic_cast<osg::DoubleArray*>( copy._knotsV->clone(copyop) );
-    _weights = dynamic_cast<osg::DoubleArray*>( copy._weights->clone(copyop) );
+    if ( copy._tangents.valid() && (copyop.getCopyFlags()&osg::CopyOp::DEEP_COPY_ARRAYS) )
+        _tangents = dynamic_cast<osg::Vec3Array*>( copy._tangents->clone(copyop) );
+    if ( copy._ctrlPts.valid() ) _ctrlPts = dynamic_cast<osg::Vec3Array*>( copy._ctrlPts->clone(copyop) );
+    if ( copy._knotsU.valid() ) _knotsU = dynamic_cast<osg::DoubleArray*>( copy._knotsU->clone(copyop) );
+    if ( copy._knotsV.valid() ) _knotsV = dynamic_cast<osg::DoubleArray*>( copy._knotsV->clone(copyop) );
+    if ( copy._weights.valid() ) _weights = dynamic_cast<osg::DoubleArray*>( copy._weights->clone(copyop) );
 }
 
 NurbsSurface::NurbsSurface( osg::Vec3Array* pts, osg::DoubleArray* weights, 
                            osg::DoubleArray* knotsU, osg::DoubleArray* knotsV,
                            unsigned int degreeU, unsigned int degreeV, unsigned int numPathU, unsigned int numPathV ):
     osgModeling::Model(),
-    _ctrlPts(pts), _weights(weights), _knotsU(knotsU), _knotsV(knotsV),
+    _method(0), _generateTangents(false), _ctrlPts(pts), _weights(weights), _knotsU(knotsU), _knotsV(knotsV),
     _degreeU(degreeU), _degreeV(degreeV), _numPathU(numPathU), _numPathV(numPathV)
 {
     update();
@@ -57,7 +65,7 @@ NurbsSurface::NurbsSurface( unsigned int ukcount, double* uknotPtr, unsigned int
                            unsigned int ustride, unsigned int vstride, double* ctrlPtr,
                            unsigned int uorder, unsigned int vorder, unsigned int numPathU, unsigned int numPathV ):
     osgModeling::Model(),
-    _degreeU(uorder-1), _degreeV(vorder-1), _numPathU(numPathU), _numPathV(numPathV)
+    _method(0), _generateTangents(false), _degreeU(uorder-1), _degreeV(vorder-1), _numPathU(numPathU), _numPathV(numPathV)
 {
     if ( ukcount<=uorder || ustride<2 || !uknotPtr
         || vkcount<=vorder || vstride<2 || !vknotPtr || !ctrlPtr )
@@ -127,13 +135,65 @@ void NurbsSurface::updateImplementation()
         return;
     }
 
-    // Initiate vertics & texture coordinates.
-    osg::ref_ptr<osg::Vec3Array> vertics = new osg::Vec3Array;
-    osg::ref_ptr<osg::Vec2Array> texCoords = new osg::Vec2Array;
-
     _ctrlRow = _knotsU->size()-_degreeU-1;
     _ctrlCol = _knotsV->size()-_degreeV-1;
-    useDeBoor( vertics.get() );
+    if ( _ctrlPts->size()<_ctrlRow*_ctrlCol || _weights->size()<_ctrlRow*_ctrlCol )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Knot vectors of the NURBS surface need " << _ctrlRow << "x" << _ctrlCol
+            << " control points and weights, but only " << _ctrlPts->size() << " points and "
+            << _weights->size() << " weights found." << std::endl;
+        return;
+    }
+
+    // Prepare weighted control points for evaluate(), which also does adaptive tessellation.
+    _ctrlNetCache.build( _ctrlPts.get(), _weights.get(), _ctrlRow*_ctrlCol );
+
+    if ( isAdaptive() )
+    {
+        // Distinct knots in the domains, where the surface may have creases.
+        VECTOR<double> breaksU, breaksV;
+        unsigned int i;
+        for ( i=_degreeU; i<=_ctrlRow; ++i )
+        {
+            if ( breaksU.empty() || (*_knotsU)[i]>breaksU.back() ) breaksU.push_back( (*_knotsU)[i] );
+        }
+        for ( i=_degreeV; i<=_ctrlCol; ++i )
+        {
+            if ( breaksV.empty() || (*_knotsV)[i]>breaksV.back() ) breaksV.push_back( (*_knotsV)[i] );
+        }
+
+        _tangents = NULL;
+        buildAdaptiveGeometry( breaksU, breaksV );
+        return;
+    }
+
+    // Initiate vertics, refilling the existing array unless they are picked from a finer grid.
+    osg::ref_ptr<osg::Vec3Array> vertics, normals;
+    bool sampled = _sampledVertices.valid() && _sampledVertices->size()==_numPathU*_numPathV;
+    if ( sampled )
+    {
+        // Normals picked by createCoarseModel() are already flipped like those of the finer grid.
+        vertics = _sampledVertices;
+        normals = _sampledNormals;
+        _tangents = _method==0 ? _sampledTangents.get() : NULL;
+    }
+    else if ( _method==0 )
+    {
+        // Normals & tangents are calculated along with vertices by method 0.
+        vertics = reuseArray<osg::Vec3Array>( getVertexArray() );
+        if ( getGenerateCoords()&Model::NORMAL_COORDS ) normals = reuseArray<osg::Vec3Array>( getNormalArray() );
+        _tangents = _generateTangents ? reuseArray<osg::Vec3Array>( _tangents.get() ) : NULL;
+        useCoxDeBoor( vertics.get(), normals.get(), _tangents.get() );
+    }
+    else
+    {
+        vertics = reuseArray<osg::Vec3Array>( getVertexArray() );
+        _tangents = NULL;
+        if ( _method==1 ) useDeBoor( vertics.get() );
+    }
+    _sampledVertices = NULL;
+    _sampledNormals = NULL;
+    _sampledTangents = NULL;
 
     // Create new primitives for surface.
     unsigned int bodySize = vertics->size();
@@ -146,52 +206,630 @@ void NurbsSurface::updateImplementation()
         capType = osg::PrimitiveSet::LINE_STRIP;
     }
 
-    if ( getGenerateParts()&Model::BODY_PART )
+    // Primitives are kept if only positions changed.
+    if ( !canReusePrimitives(bodySize) )
     {
-        for ( i=0; i<_numPathU-1; ++i )
+        removePrimitiveSet( 0, getPrimitiveSetList().size() );
+        if ( getGenerateParts()&Model::BODY_PART )
         {
-            osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
-            for ( j=0; j<_numPathV; ++j )
+            for ( i=0; i<_numPathU-1; ++i )
             {
-                bodySeg->push_back( j+i*_numPathV );
-                bodySeg->push_back( j+(i+1)*_numPathV );
+                osg::ref_ptr<osg::DrawElementsUInt> bodySeg = new osg::DrawElementsUInt( bodyType, 0 );
+                for ( j=0; j<_numPathV; ++j )
+                {
+                    bodySeg->push_back( j+i*_numPathV );
+                    bodySeg->push_back( j+(i+1)*_numPathV );
+                }
+                addPrimitiveSet( bodySeg.get() );
             }
-            addPrimitiveSet( bodySeg.get() );
         }
     }
 
     // Attach vertics to the geometry.
     setVertexArray( vertics.get() );
 
-    // Calculate normals using smoothing visitor.
-    if ( getGenerateCoords()&Model::NORMAL_COORDS )
+    // Calculate normals using smoothing visitor if they are not created by the evaluator.
+    if ( normals.valid() )
+    {
+        if ( !sampled && (getAuxFunctions()&Model::FLIP_NORMAL) )
+        {
+            for ( osg::Vec3Array::iterator nitr=normals->begin(); nitr!=normals->end(); ++nitr )
+                *nitr = -(*nitr);
+        }
+        setNormalArray( normals.get() );
+        setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    }
+    else if ( getGenerateCoords()&Model::NORMAL_COORDS )
     {
-        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL );
+        osgModeling::NormalVisitor::buildNormal( *this, getAuxFunctions()&Model::FLIP_NORMAL,
+            NormalVisitor::MWE, 1e-6, true, getNumThreads() );
     }
 
     // Calculate texture coordinates.
-    osg::Vec3Array::iterator itr;
     if ( getGenerateCoords()&Model::TEX_COORDS )
+        setGridTexCoords( _numPathU, _numPathV );
+
+    dirtyDisplayList();
+}
+
+Model* NurbsSurface::createCoarseModel( double ratio )
+{
+    unsigned int numU = _numPathU>1 ? reduceIntervals( _numPathU-1, ratio, 1 )+1 : _numPathU;
+    unsigned int numV = _numPathV>1 ? reduceIntervals( _numPathV-1, ratio, 1 )+1 : _numPathV;
+    if ( !isAdaptive() && numU==_numPathU && numV==_numPathV )
+        return NULL;
+
+    NurbsSurface* surface = dynamic_cast<NurbsSurface*>( clone(osg::CopyOp::SHALLOW_COPY) );
+    if ( !surface ) return NULL;
+
+    if ( isAdaptive() )
+    {
+        surface->setTolerance( _tolerance/ratio );
+        return surface;
+    }
+    surface->setNumPath( numU, numV );
+
+    // Vertices of the coarse grid are also vertices of this one if intervals are reduced by a whole factor.
+    bool needNormals = (getGenerateCoords()&Model::NORMAL_COORDS)!=0;
+    bool needTangents = _method==0 && _generateTangents;
+    if ( _updated && !_dirty && !isUpdating() && !(getAuxFunctions()&Model::OPTIMIZE_VERTEX_CACHE) )
+    {
+        surface->_sampledVertices = sampleGrid( getVertexArray(), _numPathU, _numPathV, numU, numV );
+        if ( needNormals ) surface->_sampledNormals = sampleGrid( getNormalArray(), _numPathU, _numPathV, numU, numV );
+        if ( needTangents ) surface->_sampledTangents = sampleGrid( _tangents.get(), _numPathU, _numPathV, numU, numV );
+        if ( surface->_sampledVertices.valid() && (!needNormals || surface->_sampledNormals.valid())
+            && (!needTangents || surface->_sampledTangents.valid()) )
+        {
+            surface->update();
+        }
+        surface->_sampledVertices = NULL;
+        surface->_sampledNormals = NULL;
+        surface->_sampledTangents = NULL;
+    }
+    return surface;
+}
+
+bool NurbsSurface::evaluate( const double* params, unsigned int n, osg::Vec3* out ) const
+{
+    if ( !_ctrlPts || !_knotsU || !_knotsV || !params || !out
+        || _knotsU->size()<=_degreeU+1 || _knotsV->size()<=_degreeV+1 )
+        return false;
+
+    unsigned int i, a, b, lane, start, orderU=_degreeU+1, orderV=_degreeV+1;
+    unsigned int numRow = _knotsU->size()-_degreeU-1;
+    unsigned int numCol = _knotsV->size()-_degreeV-1;
+    unsigned int numCtrl = numRow*numCol;
+    if ( _ctrlPts->size()<numCtrl || (_weights.valid() && _weights->size()<numCtrl) )
+        return false;
+
+    // Use homogeneous control points prepared by update(), or convert them for this call only.
+    NurbsCurve::ControlNetCache localNet;
+    const NurbsCurve::ControlNetCache* net = &_ctrlNetCache;
+    if ( !_ctrlNetCache.valid(_ctrlPts.get(), _weights.get(), numCtrl) )
+    {
+        localNet.build( _ctrlPts.get(), _weights.get(), numCtrl );
+        net = &localNet;
+    }
+    const double *px=&(net->_x.front()), *py=&(net->_y.front()), *pz=&(net->_z.front()), *pw=&(net->_w.front());
+
+    // Small batches should not allocate, so basis values of usual degrees are kept on the stack.
+    const unsigned int block = EVALUATE_BLOCK_SIZE;
+    double basisBuffer[32*EVALUATE_BLOCK_SIZE], valueBuffer[16];
+    VECTOR<double> heapBuffer;
+    double *basisU=basisBuffer, *basisV=basisBuffer+16*block, *values=valueBuffer;
+    if ( orderU>16 || orderV>16 )
+    {
+        unsigned int maxOrder = osg::maximum( orderU, orderV );
+        heapBuffer.resize( maxOrder*(2*block+1) );
+        basisU = &(heapBuffer.front());
+        basisV = basisU + maxOrder*block;
+        values = basisV + maxOrder*block;
+    }
+
+    double minU=(*_knotsU)[_degreeU], maxU=(*_knotsU)[numRow];
+    double minV=(*_knotsV)[_degreeV], maxV=(*_knotsV)[numCol];
+    unsigned int first[EVALUATE_BLOCK_SIZE];
+    double x[EVALUATE_BLOCK_SIZE], y[EVALUATE_BLOCK_SIZE], z[EVALUATE_BLOCK_SIZE], w[EVALUATE_BLOCK_SIZE];
+    for ( start=0; start<n; start+=block )
     {
-        double maxTexCoordOfBody = 1.0;
-        double uInterval=maxTexCoordOfBody/(_numPathU-1), vInterval=1.0f/(_numPathV-1);
+        unsigned int num = osg::minimum( block, n-start );
+        for ( lane=0; lane<block; ++lane )
+        {
+            double u = lane<num ? osg::clampBetween(params[2*(start+lane)], minU, maxU) : minU;
+            double v = lane<num ? osg::clampBetween(params[2*(start+lane)+1], minV, maxV) : minV;
+
+            unsigned int spanU = NurbsCurve::findSpan( _knotsU.get(), _degreeU, numRow, u );
+            NurbsCurve::basisFunctions( _knotsU.get(), spanU, _degreeU, u, values );
+            for ( i=0; i<orderU; ++i )
+                basisU[i*block+lane] = values[i];
 
-        for ( i=0; i<_numPathU; ++i )
+            unsigned int spanV = NurbsCurve::findSpan( _knotsV.get(), _degreeV, numCol, v );
+            NurbsCurve::basisFunctions( _knotsV.get(), spanV, _degreeV, v, values );
+            for ( i=0; i<orderV; ++i )
+                basisV[i*block+lane] = values[i];
+
+            first[lane] = (spanU-_degreeU)*numCol + spanV-_degreeV;
+        }
+
+#ifdef OSGMODELING_USE_SSE2
+        // Two lanes in each register. Spans of lanes may differ, so their control points are loaded separately.
+        for ( lane=0; lane<block; lane+=2 )
+        {
+            __m128d sx=_mm_setzero_pd(), sy=_mm_setzero_pd(), sz=_mm_setzero_pd(), sw=_mm_setzero_pd();
+            for ( a=0; a<orderU; ++a )
+            {
+                __m128d bu = _mm_loadu_pd( basisU+a*block+lane );
+                const unsigned int row0=first[lane]+a*numCol, row1=first[lane+1]+a*numCol;
+                for ( b=0; b<orderV; ++b )
+                {
+                    __m128d coef = _mm_mul_pd( bu, _mm_loadu_pd(basisV+b*block+lane) );
+                    sx = _mm_add_pd( sx, _mm_mul_pd(_mm_set_pd(px[row1+b], px[row0+b]), coef) );
+                    sy = _mm_add_pd( sy, _mm_mul_pd(_mm_set_pd(py[row1+b], py[row0+b]), coef) );
+                    sz = _mm_add_pd( sz, _mm_mul_pd(_mm_set_pd(pz[row1+b], pz[row0+b]), coef) );
+                    sw = _mm_add_pd( sw, _mm_mul_pd(_mm_set_pd(pw[row1+b], pw[row0+b]), coef) );
+                }
+            }
+            _mm_storeu_pd( x+lane, sx );
+            _mm_storeu_pd( y+lane, sy );
+            _mm_storeu_pd( z+lane, sz );
+            _mm_storeu_pd( w+lane, sw );
+        }
+#else
+        for ( lane=0; lane<block; ++lane )
+            x[lane] = y[lane] = z[lane] = w[lane] = 0.0;
+        for ( a=0; a<orderU; ++a )
         {
-            for ( j=0; j<_numPathV; ++j )
+            for ( b=0; b<orderV; ++b )
             {
-                texCoords->push_back(
-                    osg::Vec2(uInterval*i, vInterval*j) );
+                for ( lane=0; lane<block; ++lane )
+                {
+                    unsigned int index = first[lane] + a*numCol + b;
+                    double coef = basisU[a*block+lane] * basisV[b*block+lane];
+                    x[lane] += px[index] * coef;
+                    y[lane] += py[index] * coef;
+                    z[lane] += pz[index] * coef;
+                    w[lane] += pw[index] * coef;
+                }
             }
         }
+#endif
 
-        setTexCoordArray( 0, texCoords.get() );
+        for ( lane=0; lane<num; ++lane )
+        {
+            if ( w[lane] )
+                out[start+lane].set( x[lane]/w[lane], y[lane]/w[lane], z[lane]/w[lane] );
+            else
+                out[start+lane].set( 0.0f, 0.0f, 0.0f );
+        }
     }
+    return true;
+}
 
+bool NurbsSurface::getHomogeneousPoints( VECTOR<osg::Vec4d>& ptsW ) const
+{
+    if ( !_ctrlPts || !_knotsU || !_knotsV || _knotsU->size()<=_degreeU+1 || _knotsV->size()<=_degreeV+1 )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Control points and knot vectors of the NURBS surface should be set first." << std::endl;
+        return false;
+    }
+
+    unsigned int numCtrl = (_knotsU->size()-_degreeU-1) * (_knotsV->size()-_degreeV-1);
+    if ( _ctrlPts->size()<numCtrl || (_weights.valid() && _weights->size()<numCtrl) )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Knot vectors of the NURBS surface need " << numCtrl
+            << " control points and weights." << std::endl;
+        return false;
+    }
+
+    ptsW.resize( numCtrl );
+    for ( unsigned int i=0; i<numCtrl; ++i )
+    {
+        double w = _weights.valid() ? (*_weights)[i] : 1.0;
+        ptsW[i] = osg::Vec4d( osg::Vec3d((*_ctrlPts)[i])*w, w );
+    }
+    return true;
+}
+
+void NurbsSurface::setHomogeneousPoints( const VECTOR<osg::Vec4d>& ptsW )
+{
+    if ( !_weights ) _weights = new osg::DoubleArray;
+    _ctrlPts->resize( ptsW.size() );
+    _weights->resize( ptsW.size() );
+    for ( unsigned int i=0; i<ptsW.size(); ++i )
+    {
+        double w = ptsW[i].w();
+        (*_weights)[i] = w;
+        if ( w ) (*_ctrlPts)[i].set( ptsW[i].x()/w, ptsW[i].y()/w, ptsW[i].z()/w );
+    }
+    _ctrlRow = _knotsU->size()-_degreeU-1;
+    _ctrlCol = _knotsV->size()-_degreeV-1;
+    _ctrlNetCache.clear();
+    dirtyModel( DIRTY_VERTICES );
+}
+
+// Refine a control net of numRow x numCol homogeneous points in U (rows) & V (columns) directions.
+static void refineControlNet( unsigned int degreeU, unsigned int degreeV,
+                              const osg::DoubleArray* knotsU, const osg::DoubleArray* knotsV,
+                              const VECTOR<osg::Vec4d>& ptsW,
+                              const VECTOR<double>& newKnotsU, const VECTOR<double>& newKnotsV,
+                              osg::DoubleArray* resultKnotsU, osg::DoubleArray* resultKnotsV,
+                              VECTOR<osg::Vec4d>& resultPtsW )
+{
+    unsigned int i, j;
+    unsigned int numRow=knotsU->size()-degreeU-1, numCol=knotsV->size()-degreeV-1;
+    VECTOR<osg::Vec4d> line, refinedLine;
+
+    // Refine each column of the net in U direction.
+    unsigned int newRow = numRow + newKnotsU.size();
+    VECTOR<osg::Vec4d> net( newRow*numCol );
+    line.resize( numRow );
+    for ( j=0; j<numCol; ++j )
+    {
+        for ( i=0; i<numRow; ++i ) line[i] = ptsW[i*numCol+j];
+        NurbsCurve::refineKnotVector( degreeU, knotsU, line, newKnotsU, resultKnotsU, refinedLine );
+        for ( i=0; i<newRow; ++i ) net[i*numCol+j] = refinedLine[i];
+    }
+
+    // Refine each row of the net in V direction.
+    unsigned int newCol = numCol + newKnotsV.size();
+    resultPtsW.resize( newRow*newCol );
+    line.resize( numCol );
+    for ( i=0; i<newRow; ++i )
+    {
+        for ( j=0; j<numCol; ++j ) line[j] = net[i*numCol+j];
+        NurbsCurve::refineKnotVector( degreeV, knotsV, line, newKnotsV, resultKnotsV, refinedLine );
+        for ( j=0; j<newCol; ++j ) resultPtsW[i*newCol+j] = refinedLine[j];
+    }
+}
+
+void NurbsSurface::insertKnotU( double u, unsigned int times )
+{
+    refineKnots( VECTOR<double>(times, u), VECTOR<double>() );
+}
+
+void NurbsSurface::insertKnotV( double v, unsigned int times )
+{
+    refineKnots( VECTOR<double>(), VECTOR<double>(times, v) );
+}
+
+void NurbsSurface::refineKnots( const VECTOR<double>& newKnotsU, const VECTOR<double>& newKnotsV )
+{
+    VECTOR<osg::Vec4d> ptsW, resultPtsW;
+    if ( (newKnotsU.empty() && newKnotsV.empty()) || !getHomogeneousPoints(ptsW) ) return;
+
+    unsigned int numRow=_knotsU->size()-_degreeU-1, numCol=_knotsV->size()-_degreeV-1;
+    if ( (!newKnotsU.empty() && (newKnotsU.front()<(*_knotsU)[_degreeU] || newKnotsU.back()>(*_knotsU)[numRow]))
+        || (!newKnotsV.empty() && (newKnotsV.front()<(*_knotsV)[_degreeV] || newKnotsV.back()>(*_knotsV)[numCol])) )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Knots to insert should be inside the domain of the NURBS surface." << std::endl;
+        return;
+    }
+
+    osg::ref_ptr<osg::DoubleArray> resultKnotsU = new osg::DoubleArray;
+    osg::ref_ptr<osg::DoubleArray> resultKnotsV = new osg::DoubleArray;
+    refineControlNet( _degreeU, _degreeV, _knotsU.get(), _knotsV.get(), ptsW, newKnotsU, newKnotsV,
+        resultKnotsU.get(), resultKnotsV.get(), resultPtsW );
+    _knotsU->assign( resultKnotsU->begin(), resultKnotsU->end() );
+    _knotsV->assign( resultKnotsV->begin(), resultKnotsV->end() );
+    setHomogeneousPoints( resultPtsW );
+}
+
+unsigned int NurbsSurface::extractBezier( BezierPatches& patches, osg::DoubleArray* weights ) const
+{
+    VECTOR<osg::Vec4d> ptsW, resultPtsW;
+    if ( !getHomogeneousPoints(ptsW) ) return 0;
+
+    unsigned int numRow=_knotsU->size()-_degreeU-1, numCol=_knotsV->size()-_degreeV-1;
+    VECTOR<double> newKnotsU, newKnotsV;
+    NurbsCurve::getBezierKnots( _degreeU, numRow, _knotsU.get(), newKnotsU );
+    NurbsCurve::getBezierKnots( _degreeV, numCol, _knotsV.get(), newKnotsV );
+
+    osg::ref_ptr<osg::DoubleArray> knotsU = new osg::DoubleArray;
+    osg::ref_ptr<osg::DoubleArray> knotsV = new osg::DoubleArray;
+    refineControlNet( _degreeU, _degreeV, _knotsU.get(), _knotsV.get(), ptsW, newKnotsU, newKnotsV,
+        knotsU.get(), knotsV.get(), resultPtsW );
+
+    // Every pair of non-empty spans is now a Bezier patch.
+    unsigned int i, j, a, b, numSpanU=0, numSpanV=0;
+    numRow += newKnotsU.size();
+    numCol += newKnotsV.size();
+    for ( i=_degreeU; i<numRow; ++i ) if ( (*knotsU)[i]<(*knotsU)[i+1] ) ++numSpanU;
+    for ( j=_degreeV; j<numCol; ++j ) if ( (*knotsV)[j]<(*knotsV)[j+1] ) ++numSpanV;
+
+    unsigned int numPathU = osg::maximum( _numPathU/osg::maximum(numSpanU, 1u)+1, 2u );
+    unsigned int numPathV = osg::maximum( _numPathV/osg::maximum(numSpanV, 1u)+1, 2u );
+    for ( i=_degreeU; i<numRow; ++i )
+    {
+        if ( (*knotsU)[i]>=(*knotsU)[i+1] ) continue;
+        for ( j=_degreeV; j<numCol; ++j )
+        {
+            if ( (*knotsV)[j]>=(*knotsV)[j+1] ) continue;
+
+            osg::ref_ptr<osg::Vec3Array> pts = new osg::Vec3Array;
+            for ( a=i-_degreeU; a<=i; ++a )
+            {
+                for ( b=j-_degreeV; b<=j; ++b )
+                {
+                    const osg::Vec4d& pt = resultPtsW[a*numCol+b];
+                    if ( pt.w() ) pts->push_back( osg::Vec3(pt.x()/pt.w(), pt.y()/pt.w(), pt.z()/pt.w()) );
+                    else pts->push_back( osg::Vec3(0.0f, 0.0f, 0.0f) );
+                    if ( weights ) weights->push_back( pt.w() );
+                }
+            }
+            patches.push_back( new BezierSurface(pts.get(), _degreeU, _degreeV, numPathU, numPathV) );
+        }
+    }
+    return numSpanU*numSpanV;
+}
+
+void NurbsSurface::reorderVertexData( const VECTOR<unsigned int>& newIndices )
+{
+    if ( !_tangents.valid() || _tangents->size()!=newIndices.size() ) return;
+
+    osg::ref_ptr<osg::Vec3Array> tangents = new osg::Vec3Array( _tangents->size() );
+    for ( unsigned int i=0; i<newIndices.size(); ++i )
+        (*tangents)[newIndices[i]] = (*_tangents)[i];
+    _tangents = tangents;
+}
+
+bool NurbsSurface::updateNormals()
+{
+    if ( _method==0 && !isAdaptive() && (getGenerateCoords()&Model::NORMAL_COORDS) )
+        return flipNormals();
+    return Model::updateNormals();
+}
+
+bool NurbsSurface::updateTexCoords()
+{
+    const osg::Array* vertices = getVertexArray();
+    if ( !(getGenerateCoords()&Model::TEX_COORDS) || isAdaptive() || (getAuxFunctions()&Model::OPTIMIZE_VERTEX_CACHE)
+        || !vertices || vertices->getNumElements()!=_numPathU*_numPathV )
+        return Model::updateTexCoords();
+
+    setGridTexCoords( _numPathU, _numPathV );
     dirtyDisplayList();
+    return true;
+}
+
+void NurbsSurface::copyGeneratedData( Model& source )
+{
+    Model::copyGeneratedData( source );
+
+    NurbsSurface* surface = dynamic_cast<NurbsSurface*>( &source );
+    if ( !surface ) return;
+    _tangents = surface->_tangents;
+    _ctrlRow = surface->_ctrlRow;
+    _ctrlCol = surface->_ctrlCol;
+    _basisCacheU = surface->_basisCacheU;
+    _basisCacheV = surface->_basisCacheV;
+}
+
+void NurbsSurface::updateBasisCache()
+{
+    if ( !_basisCacheU.valid(_knotsU.get(), _degreeU, _ctrlRow, _numPathU) )
+        _basisCacheU.build( _knotsU.get(), _degreeU, _ctrlRow, _numPathU );
+    if ( !_basisCacheV.valid(_knotsV.get(), _degreeV, _ctrlCol, _numPathV) )
+        _basisCacheV.build( _knotsV.get(), _degreeV, _ctrlCol, _numPathV );
+}
+
+namespace osgModeling {
+
+class NurbsSurfaceRowTask : public ParallelTask
+{
+public:
+    NurbsSurfaceRowTask( NurbsSurface* surface, const VECTOR<osg::Vec4d>* ctrlPtsW, osg::Vec3* result,
+                         osg::Vec3* normals=0, osg::Vec3* tangents=0, unsigned char* degenerated=0 ):
+        _surface(surface), _ctrlPtsW(ctrlPtsW), _result(result),
+        _normals(normals), _tangents(tangents), _degenerated(degenerated)
+    {}
+
+    virtual void run( unsigned int begin, unsigned int end )
+    {
+        if ( _ctrlPtsW )
+            _surface->coxDeBoorRows( begin, end, *_ctrlPtsW, _result, _normals, _tangents, _degenerated );
+        else
+            _surface->deBoorRows( begin, end, _result );
+    }
+
+protected:
+    NurbsSurface* _surface;
+    const VECTOR<osg::Vec4d>* _ctrlPtsW;
+    osg::Vec3* _result;
+    osg::Vec3* _normals;
+    osg::Vec3* _tangents;
+    unsigned char* _degenerated;
+};
+
+}
+
+void NurbsSurface::useCoxDeBoor( osg::Vec3Array* result, osg::Vec3Array* normals, osg::Vec3Array* tangents )
+{
+    unsigned int m, n, j, numVertices=_numPathU*_numPathV;
+
+    // Spans & basis functions of all rows and columns are shared, and only rebuilt when knots change.
+    updateBasisCache();
+
+    // Convert control points to homogeneous coordinates once.
+    VECTOR<osg::Vec4d> ctrlPtsW( _ctrlRow*_ctrlCol );
+    for ( j=0; j<_ctrlRow*_ctrlCol; ++j )
+    {
+        double w = (*_weights)[j];
+        ctrlPtsW[j] = osg::Vec4d( (*_ctrlPts)[j].x()*w, (*_ctrlPts)[j].y()*w, (*_ctrlPts)[j].z()*w, w );
+    }
+
+    // Pre-size outputs so that rows can be written by different threads.
+    VECTOR<unsigned char> degenerated;
+    osg::Vec3 *resultPtr=0, *normalPtr=0, *tangentPtr=0;
+    result->resize( result->size()+numVertices );
+    resultPtr = &((*result)[result->size()-numVertices]);
+    if ( normals )
+    {
+        normals->resize( normals->size()+numVertices );
+        normalPtr = &((*normals)[normals->size()-numVertices]);
+        degenerated.resize( numVertices, 0 );
+    }
+    if ( tangents )
+    {
+        tangents->resize( tangents->size()+numVertices );
+        tangentPtr = &((*tangents)[tangents->size()-numVertices]);
+    }
+
+    NurbsSurfaceRowTask task( this, &ctrlPtsW, resultPtr, normalPtr, tangentPtr,
+        normals ? &(degenerated.front()) : 0 );
+    parallelRun( task, _numPathU, getNumThreads(), PARALLEL_GRAIN_SIZE/_numPathV+1 );
+
+    unsigned int numDegenerated = 0;
+    for ( j=0; j<degenerated.size(); ++j )
+    {
+        if ( degenerated[j] ) ++numDegenerated;
+    }
+
+    // Partial derivatives vanish at poles & collapsed edges, where normals are averaged from neighbors instead.
+    // A whole collapsed row (or column) takes the average of all normals of the adjacent rows (or columns).
+    if ( normals && numDegenerated )
+    {
+        osg::Vec3* nptr = normalPtr;
+        VECTOR<unsigned int> rowDegenerated(_numPathU, 0), colDegenerated(_numPathV, 0);
+        for ( m=0; m<_numPathU; ++m )
+        {
+            for ( n=0; n<_numPathV; ++n )
+            {
+                if ( !degenerated[m*_numPathV+n] ) continue;
+                ++rowDegenerated[m];
+                ++colDegenerated[n];
+            }
+        }
+
+        VECTOR<osg::Vec3> fixedNormals( _numPathU*_numPathV );
+        for ( m=0; m<_numPathU; ++m )
+        {
+            for ( n=0; n<_numPathV; ++n )
+            {
+                unsigned int pos = m*_numPathV + n;
+                if ( !degenerated[pos] ) continue;
+
+                osg::Vec3 normal;
+                if ( rowDegenerated[m]==_numPathV )
+                {
+                    for ( j=0; j<_numPathV; ++j )
+                    {
+                        if ( m>0 && !degenerated[(m-1)*_numPathV+j] ) normal += nptr[(m-1)*_numPathV+j];
+                        if ( m<_numPathU-1 && !degenerated[(m+1)*_numPathV+j] ) normal += nptr[(m+1)*_numPathV+j];
+                    }
+                }
+                else if ( colDegenerated[n]==_numPathU )
+                {
+                    for ( j=0; j<_numPathU; ++j )
+                    {
+                        if ( n>0 && !degenerated[j*_numPathV+n-1] ) normal += nptr[j*_numPathV+n-1];
+                        if ( n<_numPathV-1 && !degenerated[j*_numPathV+n+1] ) normal += nptr[j*_numPathV+n+1];
+                    }
+                }
+                else
+                {
+                    if ( m>0 && !degenerated[pos-_numPathV] ) normal += nptr[pos-_numPathV];
+                    if ( m<_numPathU-1 && !degenerated[pos+_numPathV] ) normal += nptr[pos+_numPathV];
+                    if ( n>0 && !degenerated[pos-1] ) normal += nptr[pos-1];
+                    if ( n<_numPathV-1 && !degenerated[pos+1] ) normal += nptr[pos+1];
+                }
+                normal.normalize();
+                fixedNormals[pos] = normal;
+            }
+        }
+
+        for ( j=0; j<_numPathU*_numPathV; ++j )
+        {
+            if ( degenerated[j] ) nptr[j] = fixedNormals[j];
+        }
+    }
+}
+
+void NurbsSurface::coxDeBoorRows( unsigned int begin, unsigned int end, const VECTOR<osg::Vec4d>& ctrlPtsW,
+                                  osg::Vec3* result, osg::Vec3* normals, osg::Vec3* tangents,
+                                  unsigned char* degenerated ) const
+{
+    unsigned int m, n, a, b, j;
+    unsigned int orderU=_degreeU+1, orderV=_degreeV+1;
+    bool needDerivs = normals || tangents;
+
+    VECTOR<osg::Vec4d> rowPtsW( _ctrlCol ), rowDerivsW( needDerivs?_ctrlCol:0 );
+    for ( m=begin; m<end; ++m )
+    {
+        const double* basisU = _basisCacheU.getBasis( m );
+        const double* derivsU = _basisCacheU.getDerivs( m );
+        unsigned int s = _basisCacheU._spans[m]-_degreeU;
+
+        // Contract the control net in U direction, which results in a curve in V direction.
+        for ( j=0; j<_ctrlCol; ++j )
+        {
+            osg::Vec4d pt, du;
+            for ( a=0; a<orderU; ++a )
+            {
+                const osg::Vec4d& ctrl = ctrlPtsW[(s+a)*_ctrlCol + j];
+                pt += ctrl * basisU[a];
+                if ( needDerivs ) du += ctrl * derivsU[a];
+            }
+            rowPtsW[j] = pt;
+            if ( needDerivs ) rowDerivsW[j] = du;
+        }
+
+        for ( n=0; n<_numPathV; ++n )
+        {
+            const double* basisV = _basisCacheV.getBasis( n );
+            unsigned int t = _basisCacheV._spans[n]-_degreeV;
+            unsigned int pos = m*_numPathV + n;
+
+            osg::Vec4d ptAndWeight;
+            for ( b=0; b<orderV; ++b )
+                ptAndWeight += rowPtsW[t+b] * basisV[b];
+
+            double w = ptAndWeight.w();
+            osg::Vec3d pt;
+            if ( w ) pt.set( ptAndWeight.x()/w, ptAndWeight.y()/w, ptAndWeight.z()/w );
+            result[pos] = pt;
+            if ( !needDerivs ) continue;
+
+            // Derivatives of a rational surface S = A/w: dS = (dA - dw*S) / w.
+            const double* derivsV = _basisCacheV.getDerivs( n );
+            osg::Vec4d du, dv;
+            for ( b=0; b<orderV; ++b )
+            {
+                du += rowDerivsW[t+b] * basisV[b];
+                dv += rowPtsW[t+b] * derivsV[b];
+            }
+
+            osg::Vec3d tangentU, tangentV;
+            if ( w )
+            {
+                tangentU = (osg::Vec3d(du.x(), du.y(), du.z()) - pt*du.w()) / w;
+                tangentV = (osg::Vec3d(dv.x(), dv.y(), dv.z()) - pt*dv.w()) / w;
+            }
+
+            if ( normals )
+            {
+                osg::Vec3d normal = tangentU ^ tangentV;
+                degenerated[pos] = ( normal.normalize()<=0.0 || !w ) ? 1 : 0;
+                normals[pos] = normal;
+            }
+            if ( tangents )
+            {
+                tangentU.normalize();
+                tangents[pos] = tangentU;
+            }
+        }
+    }
 }
 
 void NurbsSurface::useDeBoor( osg::Vec3Array* result )
+{
+    unsigned int numVertices = _numPathU*_numPathV;
+    result->resize( result->size()+numVertices );
+
+    NurbsSurfaceRowTask task( this, 0, &((*result)[result->size()-numVertices]) );
+    parallelRun( task, _numPathU, getNumThreads(), PARALLEL_GRAIN_SIZE/_numPathV+1 );
+}
+
+void NurbsSurface::deBoorRows( unsigned int begin, unsigned int end, osg::Vec3* result )
 {
     unsigned int m, n;
     double minU=(*_knotsU)[_degreeU], minV=(*_knotsV)[_degreeV];
@@ -199,7 +837,7 @@ void NurbsSurface::useDeBoor( osg::Vec3Array* result )
     double intervalV = ((*_knotsV)[_ctrlCol+_degreeV]-minV)/(_numPathV-1);
 
     unsigned int s = _degreeU;
-    for ( m=0; m<_numPathU; ++m )
+    for ( m=begin; m<end; ++m )
     {
         double u = minU + m*intervalU;
         while ( u>(*_knotsU)[s+1] && s<_ctrlRow-1 ) ++s;
@@ -214,13 +852,13 @@ void NurbsSurface::useDeBoor( osg::Vec3Array* result )
             ptAndWeight = lerpRecursion( _degreeU, _degreeV, s, t, u, v );
             if ( ptAndWeight.w() )
             {
-                result->push_back( osg::Vec3(
+                result[m*_numPathV+n].set(
                     ptAndWeight.x()/ptAndWeight.w(),
                     ptAndWeight.y()/ptAndWeight.w(),
-                    ptAndWeight.z()/ptAndWeight.w()) );
+                    ptAndWeight.z()/ptAndWeight.w() );
             }
             else
-                result->push_back( osg::Vec3(0.0f, 0.0f, 0.0f) );
+                result[m*_numPathV+n].set( 0.0f, 0.0f, 0.0f );
         }
     }
 }
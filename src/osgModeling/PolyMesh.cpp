@@ -233,7 +233,7 @@ void PolyMesh::findNeighbors( Face* f, FaceList& flist )
     }
 }
 
-bool PolyMesh::convertFacesToGeometry( FaceList faces, osg::Geometry* geom )
+bool PolyMesh::convertFacesToGeometry( FaceList faces, osg::Geometry* geom, unsigned int numThreads )
 {
     if ( !faces.size() || !geom ) return false;
 
@@ -264,7 +264,7 @@ bool PolyMesh::convertFacesToGeometry( FaceList faces, osg::Geometry* geom )
     geom->removePrimitiveSet( 0, geom->getPrimitiveSetList().size() );
     geom->addPrimitiveSet( indices.get() );
     geom->setTexCoordArray( 0, NULL );	// TEMP
-    NormalVisitor::buildNormal( *geom );
+    NormalVisitor::buildNormal( *geom, false, NormalVisitor::MWE, 1e-6, true, numThreads );
     geom->dirtyDisplayList();
     return true;
 }
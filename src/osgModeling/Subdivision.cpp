@@ -24,7 +24,7 @@ void Subdivision::operator()( PolyMesh* mesh )
 {
     for ( int i=0; i<_level; ++i )
         subdivide( mesh );
-    PolyMesh::convertFacesToGeometry( mesh->_faces, mesh );
+    PolyMesh::convertFacesToGeometry( mesh->_faces, mesh, _numThreads );
 }
 
 LoopSubdivision::LoopSubdivision( int level ):
@@ -22,8 +22,103 @@
 
 using namespace osgModeling;
 
-TexCoordVisitor::TexCoordVisitor()
+// Orthonormal directions of the projection frame. The first is as close to X as possible.
+static void makeFrameDirections( const osg::Vec3& axis, osg::Vec3& dirS, osg::Vec3& dirT, osg::Vec3& dirA )
 {
+    dirA = axis;
+    if ( equivalent(dirA) )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Invalid texture projection axis, Z axis will be used." << std::endl;
+        dirA.set( 0.0f, 0.0f, 1.0f );
+    }
+    dirA.normalize();
+
+    osg::Vec3 ref = fabs(dirA.x())<0.9f ? osg::Vec3(1.0f,0.0f,0.0f) : osg::Vec3(0.0f,1.0f,0.0f);
+    dirS = ref - dirA*(ref*dirA);
+    dirS.normalize();
+    dirT = dirA ^ dirS;
+}
+
+// Shared data of texture coordinates projecting.
+struct TexCoordData
+{
+    const osg::Vec3* _coords;
+    const osg::Vec3* _normals;
+    osg::Vec2* _texCoords;
+    int _mode;
+    osg::Vec3 _center;
+    osg::Vec3 _dirS, _dirT, _dirA;
+    float _invS, _invT, _invA;
+};
+
+// Project a range of vertices. Each mode has its own loop without branches on the mode, and each vertex
+// is independent, so ranges can run in different threads.
+class TexCoordTask : public ParallelTask
+{
+public:
+    TexCoordTask( TexCoordData* data ) : _data(data) {}
+
+    virtual void run( unsigned int begin, unsigned int end )
+    {
+        const TexCoordData& d = *_data;
+        const osg::Vec3* coords = d._coords;
+        osg::Vec2* texCoords = d._texCoords;
+        unsigned int i;
+        switch ( d._mode )
+        {
+        case TexCoordVisitor::CYLINDRICAL:
+            for ( i=begin; i<end; ++i )
+            {
+                osg::Vec3 p = coords[i] - d._center;
+                float x=(p*d._dirS)*d._invS, y=(p*d._dirT)*d._invT, z=(p*d._dirA)*d._invA;
+                texCoords[i].set( atan2(y, x)/(2.0f*osg::PI) + 0.5f, z + 0.5f );
+            }
+            break;
+        case TexCoordVisitor::SPHERICAL:
+            for ( i=begin; i<end; ++i )
+            {
+                osg::Vec3 p = coords[i] - d._center;
+                float x=(p*d._dirS)*d._invS, y=(p*d._dirT)*d._invT, z=(p*d._dirA)*d._invA;
+                float r = sqrtf( x*x + y*y + z*z );
+                float c = r>0.0f ? osg::clampBetween(z/r, -1.0f, 1.0f) : 0.0f;
+                texCoords[i].set( atan2(y, x)/(2.0f*osg::PI) + 0.5f, 1.0f - acos(c)/osg::PI );
+            }
+            break;
+        case TexCoordVisitor::BOX:
+            for ( i=begin; i<end; ++i )
+            {
+                osg::Vec3 p = coords[i] - d._center;
+                float x=(p*d._dirS)*d._invS, y=(p*d._dirT)*d._invT, z=(p*d._dirA)*d._invA;
+                osg::Vec3 n = d._normals ? osg::Vec3(d._normals[i]*d._dirS, d._normals[i]*d._dirT, d._normals[i]*d._dirA)
+                                         : osg::Vec3(x, y, z);
+                float nx=fabs(n.x()), ny=fabs(n.y()), nz=fabs(n.z());
+                if ( nz>=nx && nz>=ny ) texCoords[i].set( x + 0.5f, y + 0.5f );
+                else if ( nx>=ny ) texCoords[i].set( y + 0.5f, z + 0.5f );
+                else texCoords[i].set( x + 0.5f, z + 0.5f );
+            }
+            break;
+        default:
+            for ( i=begin; i<end; ++i )
+            {
+                osg::Vec3 p = coords[i] - d._center;
+                texCoords[i].set( (p*d._dirS)*d._invS + 0.5f, (p*d._dirT)*d._invT + 0.5f );
+            }
+            break;
+        }
+    }
+
+protected:
+    TexCoordData* _data;
+};
+
+TexCoordVisitor::TexCoordVisitor( int mode, unsigned int unit )
+{
+    _mode = mode;
+    _unit = unit;
+    _axis.set( 0.0f, 0.0f, 1.0f );
+    _size.set( 1.0f, 1.0f, 1.0f );
+    _autoFit = true;
+    _numThreads = 1;
     setTraversalMode( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN );
 }
 
@@ -31,6 +126,73 @@ TexCoordVisitor::~TexCoordVisitor()
 {
 }
 
+bool TexCoordVisitor::fitFrame( const osg::Geometry& geom, const osg::Vec3& axis, osg::Vec3& center, osg::Vec3& size )
+{
+    const osg::Vec3Array* coords = dynamic_cast<const osg::Vec3Array*>( geom.getVertexArray() );
+    if ( !coords || !coords->size() ) return false;
+
+    osg::Vec3 dirS, dirT, dirA;
+    makeFrameDirections( axis, dirS, dirT, dirA );
+
+    const osg::Vec3& first = coords->front();
+    osg::Vec3 minValue( first*dirS, first*dirT, first*dirA ), maxValue=minValue;
+    for ( osg::Vec3Array::const_iterator itr=coords->begin()+1; itr!=coords->end(); ++itr )
+    {
+        osg::Vec3 p( (*itr)*dirS, (*itr)*dirT, (*itr)*dirA );
+        for ( unsigned int k=0; k<3; ++k )
+        {
+            minValue[k] = osg::minimum( minValue[k], p[k] );
+            maxValue[k] = osg::maximum( maxValue[k], p[k] );
+        }
+    }
+
+    osg::Vec3 mid = (minValue + maxValue) * 0.5f;
+    center = dirS*mid[0] + dirT*mid[1] + dirA*mid[2];
+    size = maxValue - minValue;
+    return true;
+}
+
+void TexCoordVisitor::buildTexCoord( osg::Geometry& geom, int mode, const osg::Vec3& axis,
+                                     unsigned int unit, unsigned int numThreads )
+{
+    osg::Vec3 center, size;
+    if ( !fitFrame(geom, axis, center, size) ) return;
+    buildTexCoord( geom, mode, center, axis, size, unit, numThreads );
+}
+
+void TexCoordVisitor::buildTexCoord( osg::Geometry& geom, int mode, const osg::Vec3& center, const osg::Vec3& axis,
+                                     const osg::Vec3& size, unsigned int unit, unsigned int numThreads )
+{
+    osg::Vec3Array* coords = dynamic_cast<osg::Vec3Array*>( geom.getVertexArray() );
+    if ( !coords || !coords->size() ) return;
+
+    osg::Vec3Array* normals = dynamic_cast<osg::Vec3Array*>( geom.getNormalArray() );
+    if ( normals && (normals->size()!=coords->size() || geom.getNormalBinding()!=osg::Geometry::BIND_PER_VERTEX) )
+        normals = NULL;
+
+    osg::Vec2Array* texCoords = reuseArray<osg::Vec2Array>( geom.getTexCoordArray(unit) );
+    texCoords->resize( coords->size() );
+
+    // Flat directions are not scaled, to avoid dividing by zero.
+    TexCoordData data;
+    data._coords = &(coords->front());
+    data._normals = normals ? &(normals->front()) : NULL;
+    data._texCoords = &(texCoords->front());
+    data._mode = mode;
+    data._center = center;
+    makeFrameDirections( axis, data._dirS, data._dirT, data._dirA );
+    data._invS = size.x()>1e-6 ? 1.0f/size.x() : 1.0f;
+    data._invT = size.y()>1e-6 ? 1.0f/size.y() : 1.0f;
+    data._invA = size.z()>1e-6 ? 1.0f/size.z() : 1.0f;
+
+    TexCoordTask task( &data );
+    parallelRun( task, coords->size(), numThreads, PARALLEL_GRAIN_SIZE );
+
+    geom.setTexCoordArray( unit, texCoords );
+    geom.setTexCoordIndices( unit, geom.getVertexIndices() );
+    geom.dirtyDisplayList();
+}
+
 void TexCoordVisitor::apply(osg::Geode& geode)
 {
     for(unsigned int i = 0; i < geode.getNumDrawables(); i++ )
@@ -38,7 +200,8 @@ void TexCoordVisitor::apply(osg::Geode& geode)
     	osg::Geometry* geom = dynamic_cast<osg::Geometry*>( geode.getDrawable(i) );
       if ( geom )
       {
-      	// To do
+        if ( _autoFit ) buildTexCoord( *geom, _mode, _axis, _unit, _numThreads );
+        else buildTexCoord( *geom, _mode, _center, _axis, _size, _unit, _numThreads );
       }
     }
 }
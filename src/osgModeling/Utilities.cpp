@@ -16,6 +16,7 @@
 */
 
 #include <osg/Notify>
+#include <OpenThreads/Thread>
 #include <osgModeling/Utilities>
 
 using namespace osgModeling;
@@ -367,3 +368,58 @@ double osgModeling::factorial( const int n, bool warnLargeValue )
         result *= i++;
     return result;
 }
+
+namespace osgModeling {
+
+class ParallelThread : public OpenThreads::Thread
+{
+public:
+    ParallelThread( ParallelTask* task, unsigned int begin, unsigned int end ):
+        _task(task), _begin(begin), _end(end)
+    {}
+
+    virtual void run() { _task->run(_begin, _end); }
+
+protected:
+    ParallelTask* _task;
+    unsigned int _begin;
+    unsigned int _end;
+};
+
+}
+
+void osgModeling::parallelRun( ParallelTask& task, unsigned int numRows, unsigned int numThreads, unsigned int minRows )
+{
+    if ( !numThreads ) numThreads = OpenThreads::GetNumberOfProcessors();
+    if ( minRows ) numThreads = osg::minimum( numThreads, numRows/minRows );
+    if ( numThreads<=1 )
+    {
+        if ( numRows ) task.run( 0, numRows );
+        return;
+    }
+
+    // Start a thread for each range except the last one, which is done by the current thread.
+    VECTOR<ParallelThread*> threads;
+    unsigned int i, begin=0;
+    for ( i=0; i<numThreads-1; ++i )
+    {
+        unsigned int end = begin + (numRows-begin)/(numThreads-i);
+        ParallelThread* thread = new ParallelThread( &task, begin, end );
+        if ( thread->start()!=0 )
+        {
+            // Failed to create the thread, so do the work here.
+            delete thread;
+            task.run( begin, end );
+        }
+        else
+            threads.push_back( thread );
+        begin = end;
+    }
+    task.run( begin, numRows );
+
+    for ( i=0; i<threads.size(); ++i )
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+}
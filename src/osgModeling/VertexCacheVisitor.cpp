@@ -0,0 +1,378 @@
+/* -*-c++-*- osgModeling - Copyright (C) 2008 Wang Rui <wangray84@gmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <cmath>
+#include <cstring>
+#include <osg/TriangleIndexFunctor>
+#include <osgModeling/Model>
+#include <osgModeling/VertexCacheVisitor>
+
+using namespace osgModeling;
+
+// Parameters of the vertex score function, see Tom Forsyth's "Linear-Speed Vertex Cache Optimisation".
+#define CACHE_DECAY_POWER 1.5
+#define LAST_TRIANGLE_SCORE 0.75
+#define VALENCE_BOOST_SCALE 2.0
+#define VALENCE_BOOST_POWER 0.5
+#define MAX_VALENCE_TABLE 32
+
+struct CollectTriangles
+{
+    VECTOR<unsigned int>* _indices;
+
+    CollectTriangles() : _indices(0) {}
+
+    inline void operator()( unsigned int i1, unsigned int i2, unsigned int i3 )
+    {
+        _indices->push_back( i1 );
+        _indices->push_back( i2 );
+        _indices->push_back( i3 );
+    }
+};
+
+struct ForsythOptimizer
+{
+    struct VertexData
+    {
+        int _cachePos;
+        unsigned int _numActiveTriangles;
+        unsigned int _firstTriangle;  // Offset of adjacent triangles in _adjacency
+        double _score;
+    };
+
+    unsigned int _cacheSize;
+    VECTOR<double> _cacheScores;
+    VECTOR<double> _valenceScores;
+    VECTOR<VertexData> _vertices;
+    VECTOR<unsigned int> _adjacency;
+    VECTOR<double> _triangleScores;
+    VECTOR<unsigned char> _triangleAdded;
+
+    ForsythOptimizer( unsigned int cacheSize ) : _cacheSize(osg::maximum(cacheSize, 4u))
+    {
+        // Tabulate the score function, which is called for every vertex in the cache each step.
+        unsigned int i;
+        _cacheScores.resize( _cacheSize );
+        for ( i=0; i<_cacheSize; ++i )
+        {
+            if ( i<3 ) _cacheScores[i] = LAST_TRIANGLE_SCORE;
+            else _cacheScores[i] = pow( 1.0 - (double)(i-3)/(_cacheSize-3), CACHE_DECAY_POWER );
+        }
+        _valenceScores.resize( MAX_VALENCE_TABLE );
+        for ( i=1; i<MAX_VALENCE_TABLE; ++i )
+            _valenceScores[i] = VALENCE_BOOST_SCALE * pow( (double)i, -VALENCE_BOOST_POWER );
+    }
+
+    inline double calcScore( const VertexData& vd ) const
+    {
+        // Vertices without remaining triangles should never be chosen.
+        if ( !vd._numActiveTriangles ) return -1.0;
+
+        double score = vd._cachePos<0 ? 0.0 : _cacheScores[vd._cachePos];
+        if ( vd._numActiveTriangles<MAX_VALENCE_TABLE )
+            score += _valenceScores[vd._numActiveTriangles];
+        else
+            score += VALENCE_BOOST_SCALE * pow( (double)vd._numActiveTriangles, -VALENCE_BOOST_POWER );
+        return score;
+    }
+
+    void run( const VECTOR<unsigned int>& indices, unsigned int numVertices, VECTOR<unsigned int>& result )
+    {
+        unsigned int i, j, numTriangles=indices.size()/3;
+
+        // Build the vertex-triangle adjacency.
+        VertexData initData = { -1, 0, 0, 0.0 };
+        _vertices.assign( numVertices, initData );
+        for ( i=0; i<numTriangles*3; ++i )
+            ++_vertices[indices[i]]._numActiveTriangles;
+
+        unsigned int offset = 0;
+        for ( i=0; i<numVertices; ++i )
+        {
+            _vertices[i]._firstTriangle = offset;
+            offset += _vertices[i]._numActiveTriangles;
+        }
+
+        VECTOR<unsigned int> filled( numVertices, 0 );
+        _adjacency.resize( offset );
+        for ( i=0; i<numTriangles*3; ++i )
+        {
+            unsigned int v = indices[i];
+            _adjacency[_vertices[v]._firstTriangle + filled[v]++] = i/3;
+        }
+
+        for ( i=0; i<numVertices; ++i )
+            _vertices[i]._score = calcScore( _vertices[i] );
+
+        int bestTriangle = -1;
+        double bestScore = -1.0;
+        _triangleScores.resize( numTriangles );
+        _triangleAdded.assign( numTriangles, 0 );
+        for ( i=0; i<numTriangles; ++i )
+        {
+            _triangleScores[i] = _vertices[indices[3*i]]._score + _vertices[indices[3*i+1]]._score
+                + _vertices[indices[3*i+2]]._score;
+            if ( _triangleScores[i]>bestScore )
+            {
+                bestScore = _triangleScores[i];
+                bestTriangle = i;
+            }
+        }
+
+        // Add the best triangle each time, and only re-score vertices in the cache & their triangles.
+        VECTOR<unsigned int> cache, newCache;
+        unsigned int cursor = 0;
+        result.clear();
+        result.reserve( numTriangles*3 );
+        for ( unsigned int n=0; n<numTriangles; ++n )
+        {
+            if ( bestTriangle<0 )
+            {
+                // Nothing in the cache can be used, so go on with the next unused triangle.
+                while ( _triangleAdded[cursor] ) ++cursor;
+                bestTriangle = cursor;
+            }
+
+            const unsigned int* tri = &(indices[3*bestTriangle]);
+            _triangleAdded[bestTriangle] = 1;
+            newCache.clear();
+            for ( i=0; i<3; ++i )
+            {
+                result.push_back( tri[i] );
+                newCache.push_back( tri[i] );
+
+                // Remove the triangle from the active list of the vertex.
+                VertexData& vd = _vertices[tri[i]];
+                unsigned int* adj = &(_adjacency[vd._firstTriangle]);
+                for ( j=0; j<vd._numActiveTriangles; ++j )
+                {
+                    if ( adj[j]!=(unsigned int)bestTriangle ) continue;
+                    adj[j] = adj[vd._numActiveTriangles-1];
+                    --vd._numActiveTriangles;
+                    break;
+                }
+            }
+
+            // Move vertices of the triangle to the front of the LRU cache.
+            for ( i=0; i<cache.size(); ++i )
+            {
+                unsigned int v = cache[i];
+                if ( v!=tri[0] && v!=tri[1] && v!=tri[2] ) newCache.push_back( v );
+            }
+
+            // Update scores of vertices in the cache, including the ones just pushed out.
+            for ( i=0; i<newCache.size(); ++i )
+            {
+                VertexData& vd = _vertices[newCache[i]];
+                vd._cachePos = i<_cacheSize ? (int)i : -1;
+
+                double score = calcScore( vd );
+                double delta = score - vd._score;
+                vd._score = score;
+                for ( j=0; j<vd._numActiveTriangles; ++j )
+                    _triangleScores[_adjacency[vd._firstTriangle+j]] += delta;
+            }
+            if ( newCache.size()>_cacheSize ) newCache.resize( _cacheSize );
+            cache.swap( newCache );
+
+            // Find the next triangle from ones using vertices in the cache.
+            bestTriangle = -1;
+            bestScore = -1.0;
+            for ( i=0; i<cache.size(); ++i )
+            {
+                const VertexData& vd = _vertices[cache[i]];
+                for ( j=0; j<vd._numActiveTriangles; ++j )
+                {
+                    unsigned int t = _adjacency[vd._firstTriangle+j];
+                    if ( _triangleScores[t]>bestScore )
+                    {
+                        bestScore = _triangleScores[t];
+                        bestTriangle = t;
+                    }
+                }
+            }
+        }
+    }
+};
+
+static void reorderArray( osg::Array* array, const VECTOR<unsigned int>& newIndices )
+{
+    if ( !array || array->getNumElements()!=newIndices.size() || !array->getNumElements() ) return;
+
+    unsigned int i, size=array->getElementSize(), num=newIndices.size();
+    unsigned char* data = (unsigned char*)const_cast<void*>( (const void*)array->getDataPointer() );
+    VECTOR<unsigned char> copy( data, data+size*num );
+    for ( i=0; i<num; ++i )
+        memcpy( data+newIndices[i]*size, &(copy[i*size]), size );
+    array->dirty();
+}
+
+VertexCacheVisitor::VertexCacheVisitor( unsigned int cacheSize, bool reorderVertices )
+:   _cacheSize(cacheSize), _reorderVertices(reorderVertices)
+{
+    setTraversalMode( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN );
+}
+
+VertexCacheVisitor::~VertexCacheVisitor()
+{
+}
+
+double VertexCacheVisitor::calcACMR( const VECTOR<unsigned int>& triangles, unsigned int numVertices, unsigned int cacheSize )
+{
+    unsigned int numTriangles = triangles.size()/3;
+    if ( !numTriangles ) return 0.0;
+
+    // A vertex is in the FIFO cache if it is one of the last 'cacheSize' missed vertices.
+    VECTOR<unsigned int> missedAt( numVertices, 0 );
+    unsigned int misses = 0;
+    for ( unsigned int i=0; i<numTriangles*3; ++i )
+    {
+        unsigned int v = triangles[i];
+        if ( v>=numVertices ) continue;
+        if ( !missedAt[v] || misses-missedAt[v]>=cacheSize )
+            missedAt[v] = ++misses;
+    }
+    return (double)misses / numTriangles;
+}
+
+double VertexCacheVisitor::calcACMR( const osg::Geometry& geom, unsigned int cacheSize )
+{
+    const osg::Array* vertices = geom.getVertexArray();
+    if ( !vertices ) return 0.0;
+
+    osg::TriangleIndexFunctor<CollectTriangles> collector;
+    VECTOR<unsigned int> triangles;
+    collector._indices = &triangles;
+    geom.accept( collector );
+    return calcACMR( triangles, vertices->getNumElements(), cacheSize );
+}
+
+bool VertexCacheVisitor::optimize( osg::Geometry& geom, unsigned int cacheSize, bool reorderVertices,
+                                   double* acmr, VECTOR<unsigned int>* newIndices )
+{
+    osg::Array* vertices = geom.getVertexArray();
+    if ( !vertices || !vertices->getNumElements() ) return false;
+    if ( geom.getVertexIndices() )
+    {
+        osg::notify(osg::WARN) << "osgModeling: Geometries with vertex indices are not supported by vertex cache optimizing." << std::endl;
+        return false;
+    }
+
+    // Indices out of the vertex array can't be reordered, so such geometries are left unchanged.
+    osg::Geometry::PrimitiveSetList& primitives = geom.getPrimitiveSetList();
+    unsigned int i, j, numVertices=vertices->getNumElements();
+    for ( i=0; i<primitives.size(); ++i )
+    {
+        osg::PrimitiveSet* ps = primitives[i].get();
+        for ( j=0; j<ps->getNumIndices(); ++j )
+        {
+            if ( ps->index(j)<numVertices ) continue;
+            osg::notify(osg::WARN) << "osgModeling: Index " << ps->index(j) << " is out of " << numVertices
+                << " vertices, the geometry is not optimized for vertex cache." << std::endl;
+            return false;
+        }
+    }
+
+    Model::mergePrimitiveSets( geom );
+
+    osg::DrawElements* triangleSet = 0;
+    for ( i=0; i<primitives.size(); ++i )
+    {
+        if ( primitives[i]->getMode()!=osg::PrimitiveSet::TRIANGLES ) continue;
+        triangleSet = dynamic_cast<osg::DrawElements*>( primitives[i].get() );
+        if ( triangleSet ) break;
+    }
+    if ( !triangleSet || !triangleSet->getNumIndices() ) return false;
+
+    unsigned int numIndices = triangleSet->getNumIndices();
+    VECTOR<unsigned int> triangles( numIndices ), result;
+    for ( i=0; i<numIndices; ++i )
+        triangles[i] = triangleSet->index(i);
+
+    double acmrBefore = calcACMR( triangles, numVertices, cacheSize );
+    ForsythOptimizer optimizer( cacheSize );
+    optimizer.run( triangles, numVertices, result );
+
+    // Assign new indices in the order that vertices are first used.
+    VECTOR<unsigned int> newOrder;
+    if ( reorderVertices )
+    {
+        unsigned int count = 0;
+        newOrder.resize( numVertices, numVertices );
+        for ( i=0; i<numIndices; ++i )
+        {
+            if ( newOrder[result[i]]==numVertices ) newOrder[result[i]] = count++;
+            result[i] = newOrder[result[i]];
+        }
+        for ( i=0; i<numVertices; ++i )
+        {
+            if ( newOrder[i]==numVertices ) newOrder[i] = count++;
+        }
+
+        reorderArray( vertices, newOrder );
+        if ( geom.getNormalBinding()==osg::Geometry::BIND_PER_VERTEX ) reorderArray( geom.getNormalArray(), newOrder );
+        if ( geom.getColorBinding()==osg::Geometry::BIND_PER_VERTEX ) reorderArray( geom.getColorArray(), newOrder );
+        for ( i=0; i<geom.getNumTexCoordArrays(); ++i )
+            reorderArray( geom.getTexCoordArray(i), newOrder );
+        for ( i=0; i<geom.getNumVertexAttribArrays(); ++i )
+        {
+            if ( geom.getVertexAttribBinding(i)==osg::Geometry::BIND_PER_VERTEX )
+                reorderArray( geom.getVertexAttribArray(i), newOrder );
+        }
+
+        // Re-index other primitive sets, such as points & lines.
+        for ( i=0; i<primitives.size(); ++i )
+        {
+            osg::PrimitiveSet* ps = primitives[i].get();
+            if ( ps==triangleSet ) continue;
+
+            osg::ref_ptr<osg::DrawElementsUInt> elements = new osg::DrawElementsUInt( ps->getMode(), 0 );
+            for ( j=0; j<ps->getNumIndices(); ++j )
+            {
+                unsigned int index = ps->index(j);
+                elements->push_back( index<numVertices ? newOrder[index] : index );
+            }
+            primitives[i] = elements.get();
+        }
+    }
+
+    // Referenced vertices come first after reordering, so indices still fit the original type.
+    for ( i=0; i<numIndices; ++i )
+        triangleSet->setElement( i, result[i] );
+    triangleSet->dirty();
+    geom.dirtyDisplayList();
+
+    double acmrAfter = calcACMR( result, numVertices, cacheSize );
+    osg::notify(osg::INFO) << "osgModeling: Vertex cache optimized, ACMR " << acmrBefore << " -> " << acmrAfter
+        << " with cache size " << cacheSize << "." << std::endl;
+    if ( acmr )
+    {
+        acmr[0] = acmrBefore;
+        acmr[1] = acmrAfter;
+    }
+    if ( newIndices ) newIndices->swap( newOrder );
+    return true;
+}
+
+void VertexCacheVisitor::apply( osg::Geode& geode )
+{
+    for ( unsigned int i=0; i<geode.getNumDrawables(); ++i )
+    {
+        osg::Geometry* geom = dynamic_cast<osg::Geometry*>( geode.getDrawable(i) );
+        if ( geom ) optimize( *geom, _cacheSize, _reorderVertices );
+    }
+}
@@ -21,14 +21,64 @@
 #include <osgDB/Output>
 #include <osgModeling/Bezier>
 
+#include "IO_Utils.h"
+
 bool osgModeling_BezierCurve_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::BezierCurve& curve = static_cast<osgModeling::BezierCurve&>(obj);
+
+    int method = 0;
+    if ( fr[0].matchWord("Method") && fr[1].getInt(method) )
+    {
+        curve.setMethod( method );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    unsigned int value = 0;
+    if ( fr[0].matchWord("Degree") && fr[1].getUInt(value) )
+    {
+        curve.setDegree( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("NumPath") && fr[1].getUInt(value) )
+    {
+        curve.setNumPath( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    double continuity = 0.0;
+    if ( fr[0].matchWord("Continuity") && fr[1].getFloat(continuity) )
+    {
+        curve.setContinuity( continuity );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    osg::Vec3Array* ctrlPts = osgModeling_readVec3Array( fr, "CtrlPoints" );
+    if ( ctrlPts )
+    {
+        curve.setCtrlPoints( ctrlPts );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_BezierCurve_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::BezierCurve& curve = static_cast<const osgModeling::BezierCurve&>(obj);
+    std::streamsize precision = fw.precision( 15 );
+    fw.indent() << "Method " << curve.getMethod() << std::endl;
+    fw.indent() << "Degree " << curve.getDegree() << std::endl;
+    fw.indent() << "NumPath " << curve.getNumPath() << std::endl;
+    fw.indent() << "Continuity " << curve.getContinuity() << std::endl;
+    if ( curve.getCtrlPoints() )
+        osgModeling_writeVec3Array( fw, "CtrlPoints", *(curve.getCtrlPoints()) );
+    fw.precision( precision );
     return true;
 }
 
@@ -43,18 +93,55 @@ osgDB::RegisterDotOsgWrapperProxy g_osgModeling_BezierCurveProxy(
 bool osgModeling_BezierSurface_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::BezierSurface& surface = static_cast<osgModeling::BezierSurface&>(obj);
+
+    int method = 0;
+    if ( fr[0].matchWord("Method") && fr[1].getInt(method) )
+    {
+        surface.setMethod( method );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    unsigned int u = 0, v = 0;
+    if ( fr[0].matchWord("Degree") && fr[1].getUInt(u) && fr[2].getUInt(v) )
+    {
+        surface.setDegree( u, v );
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("NumPath") && fr[1].getUInt(u) && fr[2].getUInt(v) )
+    {
+        surface.setNumPath( u, v );
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    osg::Vec3Array* ctrlPts = osgModeling_readVec3Array( fr, "CtrlPoints" );
+    if ( ctrlPts )
+    {
+        surface.setCtrlPoints( ctrlPts );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_BezierSurface_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::BezierSurface& surface = static_cast<const osgModeling::BezierSurface&>(obj);
+    fw.indent() << "Method " << surface.getMethod() << std::endl;
+    fw.indent() << "Degree " << surface.getDegreeU() << " " << surface.getDegreeV() << std::endl;
+    fw.indent() << "NumPath " << surface.getNumPathU() << " " << surface.getNumPathV() << std::endl;
+    if ( surface.getCtrlPoints() )
+        osgModeling_writeVec3Array( fw, "CtrlPoints", *(surface.getCtrlPoints()) );
     return true;
 }
 
 osgDB::RegisterDotOsgWrapperProxy g_osgModeling_BezierSurfaceProxy(
     new osgModeling::BezierSurface,
-    "osgModeling::BezierCurve",
-    "Object Drawable Geometry osgModeling::Model osgModeling::BezierSurface",
+    "osgModeling::BezierSurface",
+    "Object Drawable osgModeling::Model osgModeling::BezierSurface",
     &osgModeling_BezierSurface_readData,
     &osgModeling_BezierSurface_writeData
 );
@@ -15,20 +15,56 @@
 * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <typeinfo>
 #include <osg/io_utils>
 #include <osgDB/Registry>
 #include <osgDB/Input>
 #include <osgDB/Output>
 #include <osgModeling/Curve>
 
+#include "IO_Utils.h"
+
 bool osgModeling_Curve_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::Curve& curve = static_cast<osgModeling::Curve&>(obj);
+
+    double chordHeight=0.0, angle=0.0;
+    if ( fr[0].matchWord("Tolerance") && fr[1].getFloat(chordHeight) && fr[2].getFloat(angle) )
+    {
+        curve.setTolerance( chordHeight, angle );
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    unsigned int maxSubdivision = 0;
+    if ( fr[0].matchWord("MaxSubdivision") && fr[1].getUInt(maxSubdivision) )
+    {
+        curve.setMaxSubdivision( maxSubdivision );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    osg::Vec3Array* path = osgModeling_readVec3Array( fr, "Path" );
+    if ( path )
+    {
+        curve.setPath( path );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_Curve_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::Curve& curve = static_cast<const osgModeling::Curve&>(obj);
+    std::streamsize precision = fw.precision( 15 );
+    fw.indent() << "Tolerance " << curve.getChordHeightTolerance() << " " << curve.getAngleTolerance() << std::endl;
+    fw.indent() << "MaxSubdivision " << curve.getMaxSubdivision() << std::endl;
+
+    // Inherited curves regenerate their paths from own parameters, so only points of plain curves are saved.
+    if ( typeid(curve)==typeid(osgModeling::Curve) && curve.getPath() )
+        osgModeling_writeVec3Array( fw, "Path", *(curve.getPath()) );
+    fw.precision( precision );
     return true;
 }
 
@@ -21,21 +21,60 @@
 #include <osgDB/Output>
 #include <osgModeling/Extrude>
 
+#include "IO_Utils.h"
+
 bool osgModeling_Extrude_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::Extrude& extrude = static_cast<osgModeling::Extrude&>(obj);
+
+    double value = 0.0;
+    if ( fr[0].matchWord("Length") && fr[1].getFloat(value) )
+    {
+        extrude.setExtrudeLength( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("Scale") && fr[1].getFloat(value) )
+    {
+        extrude.setExtrudeScale( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    osg::Vec3 dir;
+    if ( osgModeling_readVec3(fr, "Direction", dir) )
+    {
+        extrude.setExtrudeDirection( dir );
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("Profile") )
+    {
+        fr += 1;
+        extrude.setProfile( osgModeling_readCurve(fr) );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_Extrude_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::Extrude& extrude = static_cast<const osgModeling::Extrude&>(obj);
+    std::streamsize precision = fw.precision( 15 );
+    fw.indent() << "Length " << extrude.getExtrudeLength() << std::endl;
+    fw.indent() << "Scale " << extrude.getExtrudeScale() << std::endl;
+    fw.indent() << "Direction " << extrude.getExtrudeDirection() << std::endl;
+    osgModeling_writeCurve( fw, "Profile", extrude.getProfile() );
+    fw.precision( precision );
     return true;
 }
 
 osgDB::RegisterDotOsgWrapperProxy g_osgModeling_ExtrudeProxy(
     new osgModeling::Extrude,
     "osgModeling::Extrude",
-    "Object Drawable Geometry osgModeling::Model osgModeling::Extrude",
+    "Object Drawable osgModeling::Model osgModeling::Extrude",
     &osgModeling_Extrude_readData,
     &osgModeling_Extrude_writeData
 );
@@ -21,14 +21,62 @@
 #include <osgDB/Output>
 #include <osgModeling/Helix>
 
+#include "IO_Utils.h"
+
 bool osgModeling_Helix_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::Helix& helix = static_cast<osgModeling::Helix&>(obj);
+
+    double value = 0.0;
+    if ( fr[0].matchWord("Coils") && fr[1].getFloat(value) )
+    {
+        helix.setHelixCoils( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("PitchUnit") && fr[1].getFloat(value) )
+    {
+        helix.setHelixPitchUnit( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("Radius") && fr[1].getFloat(value) )
+    {
+        helix.setHelixRadius( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    osg::Vec3 origin;
+    if ( osgModeling_readVec3(fr, "Origin", origin) )
+    {
+        helix.setLatheOrigin( origin );
+        itAdvanced = true;
+    }
+
+    unsigned int numPath = 0;
+    if ( fr[0].matchWord("NumPath") && fr[1].getUInt(numPath) )
+    {
+        helix.setNumPath( numPath );
+        fr += 2;
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_Helix_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::Helix& helix = static_cast<const osgModeling::Helix&>(obj);
+    std::streamsize precision = fw.precision( 15 );
+    fw.indent() << "Coils " << helix.getHelixCoils() << std::endl;
+    fw.indent() << "PitchUnit " << helix.getHelixPitchUnit() << std::endl;
+    fw.indent() << "Radius " << helix.getHelixRadius() << std::endl;
+    fw.indent() << "Origin " << helix.getLatheOrigin() << std::endl;
+    fw.indent() << "NumPath " << helix.getNumPath() << std::endl;
+    fw.precision( precision );
     return true;
 }
 
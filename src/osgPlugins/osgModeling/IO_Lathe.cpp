@@ -21,21 +21,68 @@
 #include <osgDB/Output>
 #include <osgModeling/Lathe>
 
+#include "IO_Utils.h"
+
 bool osgModeling_Lathe_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::Lathe& lathe = static_cast<osgModeling::Lathe&>(obj);
+
+    unsigned int segments = 0;
+    if ( fr[0].matchWord("Segments") && fr[1].getUInt(segments) )
+    {
+        lathe.setLatheSegments( segments );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    double radian = 0.0;
+    if ( fr[0].matchWord("Radian") && fr[1].getFloat(radian) )
+    {
+        lathe.setLatheRadian( radian );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    osg::Vec3 v;
+    if ( osgModeling_readVec3(fr, "Axis", v) )
+    {
+        lathe.setLatheAxis( v );
+        itAdvanced = true;
+    }
+
+    if ( osgModeling_readVec3(fr, "Origin", v) )
+    {
+        lathe.setLatheOrigin( v );
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("Profile") )
+    {
+        fr += 1;
+        lathe.setProfile( osgModeling_readCurve(fr) );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_Lathe_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::Lathe& lathe = static_cast<const osgModeling::Lathe&>(obj);
+    std::streamsize precision = fw.precision( 15 );
+    fw.indent() << "Segments " << (unsigned int)lathe.getLatheSegments() << std::endl;
+    fw.indent() << "Radian " << lathe.getLatheRadian() << std::endl;
+    fw.indent() << "Axis " << lathe.getLatheAxis() << std::endl;
+    fw.indent() << "Origin " << lathe.getLatheOrigin() << std::endl;
+    osgModeling_writeCurve( fw, "Profile", lathe.getProfile() );
+    fw.precision( precision );
     return true;
 }
 
 osgDB::RegisterDotOsgWrapperProxy g_osgModeling_LatheProxy(
     new osgModeling::Lathe,
     "osgModeling::Lathe",
-    "Object Drawable Geometry osgModeling::Model osgModeling::Lathe",
+    "Object Drawable osgModeling::Model osgModeling::Lathe",
     &osgModeling_Lathe_readData,
     &osgModeling_Lathe_writeData
 );
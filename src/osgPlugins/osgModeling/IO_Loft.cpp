@@ -21,21 +21,59 @@
 #include <osgDB/Output>
 #include <osgModeling/Loft>
 
+#include "IO_Utils.h"
+
 bool osgModeling_Loft_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::Loft& loft = static_cast<osgModeling::Loft&>(obj);
+
+    int method = 0;
+    if ( fr[0].matchWord("Method") && fr[1].getInt(method) )
+    {
+        loft.setMethod( method );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("Profile") )
+    {
+        fr += 1;
+        loft.setProfile( osgModeling_readCurve(fr) );
+        itAdvanced = true;
+    }
+
+    // Shapes are saved with their positions on the path in ascending order, so inserting keeps the positions.
+    unsigned int pos = 0;
+    if ( fr[0].matchWord("Shape") && fr[1].getUInt(pos) )
+    {
+        fr += 2;
+        loft.insertShape( osgModeling_readCurve(fr), pos );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_Loft_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::Loft& loft = static_cast<const osgModeling::Loft&>(obj);
+    fw.indent() << "Method " << loft.getMethod() << std::endl;
+    osgModeling_writeCurve( fw, "Profile", loft.getProfile() );
+
+    for ( unsigned int i=0; i<loft.getNumShapes(); ++i )
+    {
+        const osgModeling::Curve* shape = loft.getShape( i );
+        if ( !shape ) continue;
+        fw.indent() << "Shape " << i << std::endl;
+        fw.writeObject( *shape );
+    }
     return true;
 }
 
 osgDB::RegisterDotOsgWrapperProxy g_osgModeling_LoftProxy(
     new osgModeling::Loft,
     "osgModeling::Loft",
-    "Object Drawable Geometry osgModeling::Model osgModeling::Loft",
+    "Object Drawable osgModeling::Model osgModeling::Loft",
     &osgModeling_Loft_readData,
     &osgModeling_Loft_writeData
 );
@@ -15,6 +15,7 @@
 * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <typeinfo>
 #include <osg/io_utils>
 #include <osgDB/Registry>
 #include <osgDB/Input>
@@ -24,11 +25,62 @@
 bool osgModeling_Model_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::Model& model = static_cast<osgModeling::Model&>(obj);
+
+    int value = 0;
+    if ( fr[0].matchWord("GenerateParts") && fr[1].getInt(value) )
+    {
+        model.setGenerateParts( value );
+        fr += 2;
+        itAdvanced = true;
+
+        // Inherited models are saved without vertices & primitives. Regenerate them in the first update traversal.
+        if ( typeid(model)!=typeid(osgModeling::Model) && !model.getUpdateCallback() )
+            model.setUpdateCallback( new osgModeling::ModelUpdateCallback );
+    }
+
+    if ( fr[0].matchWord("GenerateCoords") && fr[1].getInt(value) )
+    {
+        model.setGenerateCoords( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("AuxFunctions") && fr[1].getInt(value) )
+    {
+        model.setAuxFunctions( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    double tolerance = 0.0;
+    if ( fr[0].matchWord("Tolerance") && fr[1].getFloat(tolerance) )
+    {
+        model.setTolerance( tolerance );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    unsigned int maxSubdivision = 0;
+    if ( fr[0].matchWord("MaxSubdivision") && fr[1].getUInt(maxSubdivision) )
+    {
+        model.setMaxSubdivision( maxSubdivision );
+        fr += 2;
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_Model_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::Model& model = static_cast<const osgModeling::Model&>(obj);
+    std::streamsize precision = fw.precision( 15 );
+    fw.indent() << "GenerateParts " << model.getGenerateParts() << std::endl;
+    fw.indent() << "GenerateCoords " << model.getGenerateCoords() << std::endl;
+    fw.indent() << "AuxFunctions " << model.getAuxFunctions() << std::endl;
+    fw.indent() << "Tolerance " << model.getTolerance() << std::endl;
+    fw.indent() << "MaxSubdivision " << model.getMaxSubdivision() << std::endl;
+    fw.precision( precision );
     return true;
 }
 
@@ -39,3 +91,22 @@ osgDB::RegisterDotOsgWrapperProxy g_osgModeling_ModelProxy(
     &osgModeling_Model_readData,
     &osgModeling_Model_writeData
 );
+
+bool osgModeling_ModelUpdateCallback_readData(osg::Object& obj, osgDB::Input& fr)
+{
+    bool itAdvanced=false;
+    return itAdvanced;
+}
+
+bool osgModeling_ModelUpdateCallback_writeData(const osg::Object& obj, osgDB::Output& fw)
+{
+    return true;
+}
+
+osgDB::RegisterDotOsgWrapperProxy g_osgModeling_ModelUpdateCallbackProxy(
+    new osgModeling::ModelUpdateCallback,
+    "osgModeling::ModelUpdateCallback",
+    "Object osgModeling::ModelUpdateCallback",
+    &osgModeling_ModelUpdateCallback_readData,
+    &osgModeling_ModelUpdateCallback_writeData
+);
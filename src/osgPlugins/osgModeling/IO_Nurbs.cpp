@@ -21,14 +21,71 @@
 #include <osgDB/Output>
 #include <osgModeling/Nurbs>
 
+#include "IO_Utils.h"
+
 bool osgModeling_NurbsCurve_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::NurbsCurve& curve = static_cast<osgModeling::NurbsCurve&>(obj);
+
+    int method = 0;
+    if ( fr[0].matchWord("Method") && fr[1].getInt(method) )
+    {
+        curve.setMethod( method );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    unsigned int value = 0;
+    if ( fr[0].matchWord("Degree") && fr[1].getUInt(value) )
+    {
+        curve.setDegree( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("NumPath") && fr[1].getUInt(value) )
+    {
+        curve.setNumPath( value );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    osg::Vec3Array* ctrlPts = osgModeling_readVec3Array( fr, "CtrlPoints" );
+    if ( ctrlPts )
+    {
+        curve.setCtrlPoints( ctrlPts );
+        itAdvanced = true;
+    }
+
+    osg::DoubleArray* weights = osgModeling_readDoubleArray( fr, "Weights" );
+    if ( weights )
+    {
+        curve.setWeights( weights );
+        itAdvanced = true;
+    }
+
+    osg::DoubleArray* knots = osgModeling_readDoubleArray( fr, "Knots" );
+    if ( knots )
+    {
+        curve.setKnotVector( knots );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_NurbsCurve_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::NurbsCurve& curve = static_cast<const osgModeling::NurbsCurve&>(obj);
+    fw.indent() << "Method " << curve.getMethod() << std::endl;
+    fw.indent() << "Degree " << curve.getDegree() << std::endl;
+    fw.indent() << "NumPath " << curve.getNumPath() << std::endl;
+    if ( curve.getCtrlPoints() )
+        osgModeling_writeVec3Array( fw, "CtrlPoints", *(curve.getCtrlPoints()) );
+    if ( curve.getWeights() )
+        osgModeling_writeDoubleArray( fw, "Weights", *(curve.getWeights()) );
+    if ( curve.getKnotVector() )
+        osgModeling_writeDoubleArray( fw, "Knots", *(curve.getKnotVector()) );
     return true;
 }
 
@@ -43,18 +100,91 @@ osgDB::RegisterDotOsgWrapperProxy g_osgModeling_NurbsCurveProxy(
 bool osgModeling_NurbsSurface_readData(osg::Object& obj, osgDB::Input& fr)
 {
     bool itAdvanced=false;
+    osgModeling::NurbsSurface& surface = static_cast<osgModeling::NurbsSurface&>(obj);
+
+    int method = 0;
+    if ( fr[0].matchWord("Method") && fr[1].getInt(method) )
+    {
+        surface.setMethod( method );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("GenerateTangents") )
+    {
+        surface.setGenerateTangents( fr[1].matchWord("TRUE") );
+        fr += 2;
+        itAdvanced = true;
+    }
+
+    unsigned int u = 0, v = 0;
+    if ( fr[0].matchWord("Degree") && fr[1].getUInt(u) && fr[2].getUInt(v) )
+    {
+        surface.setDegree( u, v );
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    if ( fr[0].matchWord("NumPath") && fr[1].getUInt(u) && fr[2].getUInt(v) )
+    {
+        surface.setNumPath( u, v );
+        fr += 3;
+        itAdvanced = true;
+    }
+
+    osg::Vec3Array* ctrlPts = osgModeling_readVec3Array( fr, "CtrlPoints" );
+    if ( ctrlPts )
+    {
+        surface.setCtrlPoints( ctrlPts );
+        itAdvanced = true;
+    }
+
+    osg::DoubleArray* weights = osgModeling_readDoubleArray( fr, "Weights" );
+    if ( weights )
+    {
+        surface.setWeights( weights );
+        itAdvanced = true;
+    }
+
+    // Both knot vectors are set at once, so keep the other one.
+    osg::DoubleArray* knots = osgModeling_readDoubleArray( fr, "KnotsU" );
+    if ( knots )
+    {
+        surface.setKnotVector( knots, surface.getKnotVectorV() );
+        itAdvanced = true;
+    }
+
+    knots = osgModeling_readDoubleArray( fr, "KnotsV" );
+    if ( knots )
+    {
+        surface.setKnotVector( surface.getKnotVectorU(), knots );
+        itAdvanced = true;
+    }
     return itAdvanced;
 }
 
 bool osgModeling_NurbsSurface_writeData(const osg::Object& obj, osgDB::Output& fw)
 {
+    const osgModeling::NurbsSurface& surface = static_cast<const osgModeling::NurbsSurface&>(obj);
+    fw.indent() << "Method " << surface.getMethod() << std::endl;
+    fw.indent() << "GenerateTangents " << (surface.getGenerateTangents() ? "TRUE" : "FALSE") << std::endl;
+    fw.indent() << "Degree " << surface.getDegreeU() << " " << surface.getDegreeV() << std::endl;
+    fw.indent() << "NumPath " << surface.getNumPathU() << " " << surface.getNumPathV() << std::endl;
+    if ( surface.getCtrlPoints() )
+        osgModeling_writeVec3Array( fw, "CtrlPoints", *(surface.getCtrlPoints()) );
+    if ( surface.getWeights() )
+        osgModeling_writeDoubleArray( fw, "Weights", *(surface.getWeights()) );
+    if ( surface.getKnotVectorU() )
+        osgModeling_writeDoubleArray( fw, "KnotsU", *(surface.getKnotVectorU()) );
+    if ( surface.getKnotVectorV() )
+        osgModeling_writeDoubleArray( fw, "KnotsV", *(surface.getKnotVectorV()) );
     return true;
 }
 
 osgDB::RegisterDotOsgWrapperProxy g_osgModeling_NurbsSurfaceProxy(
     new osgModeling::NurbsSurface,
     "osgModeling::NurbsSurface",
-    "Object Drawable Geometry osgModeling::Model osgModeling::NurbsSurface",
+    "Object Drawable osgModeling::Model osgModeling::NurbsSurface",
     &osgModeling_NurbsSurface_readData,
     &osgModeling_NurbsSurface_writeData
 );
@@ -0,0 +1,119 @@
+/* -*-c++-*- osgModeling - Copyright (C) 2008 Wang Rui <wangray84@gmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <osg/io_utils>
+#include "IO_Utils.h"
+
+void osgModeling_writeVec3Array( osgDB::Output& fw, const char* name, const osg::Vec3Array& array )
+{
+    std::streamsize precision = fw.precision( 9 );
+    fw.indent() << name << " " << array.size() << " {" << std::endl;
+    fw.moveIn();
+    for ( osg::Vec3Array::const_iterator itr=array.begin(); itr!=array.end(); ++itr )
+        fw.indent() << *itr << std::endl;
+    fw.moveOut();
+    fw.indent() << "}" << std::endl;
+    fw.precision( precision );
+}
+
+void osgModeling_writeDoubleArray( osgDB::Output& fw, const char* name, const osg::DoubleArray& array )
+{
+    std::streamsize precision = fw.precision( 15 );
+    fw.indent() << name << " " << array.size() << " {" << std::endl;
+    fw.moveIn();
+    for ( osg::DoubleArray::const_iterator itr=array.begin(); itr!=array.end(); ++itr )
+        fw.indent() << *itr << std::endl;
+    fw.moveOut();
+    fw.indent() << "}" << std::endl;
+    fw.precision( precision );
+}
+
+osg::Vec3Array* osgModeling_readVec3Array( osgDB::Input& fr, const char* name )
+{
+    unsigned int size = 0;
+    if ( !fr[0].matchWord(name) || !fr[1].getUInt(size) || !fr[2].isOpenBracket() )
+        return NULL;
+
+    int entry = fr[0].getNoNestedBrackets();
+    fr += 3;
+
+    osg::ref_ptr<osg::Vec3Array> array = new osg::Vec3Array;
+    array->reserve( size );
+    while ( !fr.eof() && fr[0].getNoNestedBrackets()>entry )
+    {
+        osg::Vec3 v;
+        if ( fr[0].getFloat(v.x()) && fr[1].getFloat(v.y()) && fr[2].getFloat(v.z()) )
+        {
+            array->push_back( v );
+            fr += 3;
+        }
+        else ++fr;
+    }
+    ++fr;
+    return array.release();
+}
+
+osg::DoubleArray* osgModeling_readDoubleArray( osgDB::Input& fr, const char* name )
+{
+    unsigned int size = 0;
+    if ( !fr[0].matchWord(name) || !fr[1].getUInt(size) || !fr[2].isOpenBracket() )
+        return NULL;
+
+    int entry = fr[0].getNoNestedBrackets();
+    fr += 3;
+
+    osg::ref_ptr<osg::DoubleArray> array = new osg::DoubleArray;
+    array->reserve( size );
+    while ( !fr.eof() && fr[0].getNoNestedBrackets()>entry )
+    {
+        double value;
+        if ( fr[0].getFloat(value) )
+            array->push_back( value );
+        ++fr;
+    }
+    ++fr;
+    return array.release();
+}
+
+bool osgModeling_readVec3( osgDB::Input& fr, const char* name, osg::Vec3& v )
+{
+    if ( fr[0].matchWord(name) && fr[1].getFloat(v.x()) && fr[2].getFloat(v.y()) && fr[3].getFloat(v.z()) )
+    {
+        fr += 4;
+        return true;
+    }
+    return false;
+}
+
+void osgModeling_writeCurve( osgDB::Output& fw, const char* name, const osgModeling::Curve* curve )
+{
+    if ( !curve ) return;
+    fw.indent() << name << std::endl;
+    fw.writeObject( *curve );
+}
+
+osgModeling::Curve* osgModeling_readCurve( osgDB::Input& fr )
+{
+    // Keep a reference, so that other objects found here are deleted.
+    osg::ref_ptr<osg::Object> object = fr.readObject();
+    osgModeling::Curve* curve = dynamic_cast<osgModeling::Curve*>( object.get() );
+    if ( !curve ) return NULL;
+
+    curve->update();
+    object.release();
+    return curve;
+}
@@ -0,0 +1,47 @@
+/* -*-c++-*- osgModeling - Copyright (C) 2008 Wang Rui <wangray84@gmail.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Lesser General Public
+* License as published by the Free Software Foundation; either
+* version 2.1 of the License, or (at your option) any later version.
+
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Lesser General Public License for more details.
+
+* You should have received a copy of the GNU Lesser General Public
+* License along with this library; if not, write to the Free Software
+* Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef OSGMODELING_IO_UTILS
+#define OSGMODELING_IO_UTILS 1
+
+#include <osg/Array>
+#include <osgDB/Input>
+#include <osgDB/Output>
+#include <osgModeling/Curve>
+
+/** Write a named array as "Name size { ... }", one element a line, with enough digits to read back the same values. */
+void osgModeling_writeVec3Array( osgDB::Output& fw, const char* name, const osg::Vec3Array& array );
+void osgModeling_writeDoubleArray( osgDB::Output& fw, const char* name, const osg::DoubleArray& array );
+
+/** Read a named array written by the functions above.
+ * \return NULL if the current field is not the named array, otherwise the new array.
+ */
+osg::Vec3Array* osgModeling_readVec3Array( osgDB::Input& fr, const char* name );
+osg::DoubleArray* osgModeling_readDoubleArray( osgDB::Input& fr, const char* name );
+
+/** Read a named vector as "Name x y z". */
+bool osgModeling_readVec3( osgDB::Input& fr, const char* name, osg::Vec3& v );
+
+/** Write a curve as "Name" followed by the object. Nothing is written if the curve is NULL. */
+void osgModeling_writeCurve( osgDB::Output& fw, const char* name, const osgModeling::Curve* curve );
+
+/** Read a curve object following the name, and update it so its path is ready for models.
+ * \return NULL if the object is not a curve.
+ */
+osgModeling::Curve* osgModeling_readCurve( osgDB::Input& fr );
+
+#endif